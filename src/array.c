@@ -33,6 +33,13 @@ int array_length(void* array) {
     return (array != NULL) ? ARRAY_OCCUPIED(array) : 0;
 }
 
+// Empties the array but keeps its capacity, so it can be refilled without reallocating
+void array_reset(void* array) {
+    if (array != NULL) {
+        ARRAY_OCCUPIED(array) = 0;
+    }
+}
+
 void array_free(void* array) {
     if (array != NULL) {
         free(ARRAY_RAW_DATA(array));
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+#include "background.h"
+
+static background_t current = {BACKGROUND_COLOR, 0xFF000000};
+
+/**
+*    The cached image of the background, and the settings and frame size it was rendered for. It is laid
+*    out like color_buffer (same pitch, layout and padding), so restoring it is a plain copy.
+**/
+static uint32_t* cache = NULL;
+static background_t cache_background;
+static int cache_width = 0;
+static int cache_height = 0;
+static int cache_pitch = 0;
+static int cache_length = 0;
+static enum buffer_layout cache_layout = BUFFER_LAYOUT_LINEAR;
+static bool cache_valid = false;
+
+static bool background_equal(const background_t* a, const background_t* b) {
+    if (a->kind != b->kind || a->color != b->color) return false;
+    if (a->kind == BACKGROUND_GRID) {
+        return a->grid_spacing == b->grid_spacing && a->grid_thickness == b->grid_thickness &&
+            a->grid_color == b->grid_color && a->grid_connected == b->grid_connected;
+    }
+    if (a->kind == BACKGROUND_IMAGE) {
+        return a->image == b->image && a->image_width == b->image_width && a->image_height == b->image_height;
+    }
+    return true;
+}
+
+static void render_grid(const background_t* background) {
+    for (int i = 0; i < cache_length; i++) {
+        cache[i] = background->color;
+    }
+    // Unconnected grids of thin lines are only dots at every spacing-th pixel of both axes
+    int jumpAmount = 1;
+    if (!background->grid_connected && background->grid_thickness == 1) {
+        jumpAmount = background->grid_spacing;
+    }
+    for (int y = 0; y < cache_height; y+=jumpAmount) {
+        for (int x = 0; x < cache_width; x+=jumpAmount) {
+            if (y % background->grid_spacing < background->grid_thickness || x % background->grid_spacing < background->grid_thickness) {
+                cache[pixel_index(x, y)] = background->grid_color;
+            }
+        }
+    }
+}
+
+// Nearest neighbour scaling of the image to the frame size
+static void render_image(const background_t* background) {
+    for (int y = 0; y < cache_height; y++) {
+        const uint32_t* image_row = &background->image[background->image_width * (int)((int64_t)y * background->image_height / cache_height)];
+        for (int x = 0; x < cache_width; x++) {
+            cache[pixel_index(x, y)] = image_row[(int64_t)x * background->image_width / cache_width];
+        }
+    }
+}
+
+bool background_prepare(void) {
+    if (current.kind == BACKGROUND_COLOR) return true;
+    if (cache_valid && cache_width == window_width && cache_height == window_height && cache_pitch == window_pitch &&
+        cache_layout == buffer_layout && background_equal(&cache_background, &current)) {
+        return true;
+    }
+    if (cache_length != buffer_length || !cache) {
+        free(cache);
+        cache = (uint32_t*) calloc(buffer_length, sizeof(uint32_t));
+        if (!cache) {
+            fprintf(stderr, "Error allocating memory for the background.\n");
+            cache_valid = false;
+            return false;
+        }
+    }
+    cache_width = window_width;
+    cache_height = window_height;
+    cache_pitch = window_pitch;
+    cache_length = buffer_length;
+    cache_layout = buffer_layout;
+    cache_background = current;
+    if (current.kind == BACKGROUND_GRID) {
+        render_grid(&current);
+    } else {
+        render_image(&current);
+    }
+    cache_valid = true;
+    return true;
+}
+
+void background_set(const background_t* background) {
+    current = *background;
+    // Images of no size would never cover the frame
+    if (current.kind == BACKGROUND_IMAGE && (!current.image || current.image_width <= 0 || current.image_height <= 0)) {
+        current.kind = BACKGROUND_COLOR;
+    }
+}
+
+void background_clear(void) {
+    if (current.kind == BACKGROUND_COLOR || !background_prepare()) {
+        clear_color_buffer(current.color);
+        return;
+    }
+    memcpy(color_buffer, cache, sizeof(uint32_t) * buffer_length);
+}
+
+void background_clear_rect(rect_t rect) {
+    if (current.kind == BACKGROUND_COLOR || !cache_valid) {
+        clear_color_buffer_rect(rect, current.color);
+        return;
+    }
+    for (int y = rect.min_y; y <= rect.max_y; y++) {
+        for (int x = rect.min_x; x <= rect.max_x;) {
+            int run_end = pixel_run_end(x, rect.max_x);
+            int index = pixel_index(x, y);
+            memcpy(&color_buffer[index], &cache[index], sizeof(uint32_t) * (run_end - x + 1));
+            x = run_end + 1;
+        }
+    }
+}
+
+void background_free(void) {
+    free(cache);
+    cache = NULL;
+    cache_valid = false;
+}
@@ -0,0 +1,45 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "display.h"
+
+enum background_kind {
+    BACKGROUND_COLOR, // a solid color
+    BACKGROUND_GRID,  // grid lines over a solid color, as drawn by draw_grid
+    BACKGROUND_IMAGE  // an image, scaled to the frame size
+};
+
+typedef struct {
+    enum background_kind kind;
+    uint32_t color; // the solid color, or the color between grid lines
+    int grid_spacing;
+    int grid_thickness;
+    uint32_t grid_color;
+    bool grid_connected;
+    const uint32_t* image; // image_width x image_height pixels, owned by the caller
+    int image_width;
+    int image_height;
+} background_t;
+
+/**
+*    Static layer every frame is drawn over. It is rendered once into a cached image whenever its settings
+*    or the frame size change, and clearing a frame is then a copy of that image instead of a clear
+*    followed by drawing the background again. Solid colors need no image and are filled directly.
+**/
+void background_set(const background_t* background);
+
+// Renders the cached image again if the background or the frame size changed since it was last rendered
+bool background_prepare(void);
+
+/**
+*    Restores the background in the whole color buffer, or only in rect. background_clear_rect can run on
+*    several threads at once, so it leaves updating the cache to a background_prepare call before.
+**/
+void background_clear(void);
+void background_clear_rect(rect_t rect);
+
+void background_free(void);
+
+#endif
@@ -0,0 +1,124 @@
+#include <math.h>
+#include "clip.h"
+
+// Signed distance of p to plane, in units that are only compared to 0: positive inside, negative outside
+static float plane_distance(vec4_t p, enum clip_plane plane, float guard_x, float guard_y) {
+    switch (plane) {
+        case CLIP_NEAR: return p.z;
+        case CLIP_FAR: return p.w - p.z;
+        case CLIP_LEFT: return p.x + guard_x * p.w;
+        case CLIP_RIGHT: return guard_x * p.w - p.x;
+        case CLIP_TOP: return guard_y * p.w - p.y;
+        case CLIP_BOTTOM: return p.y + guard_y * p.w;
+        default: return 0;
+    }
+}
+
+// Point at t along the edge from a to b; clip space is linear, so interpolating there keeps perspective right
+static clip_vertex_t clip_vertex_lerp(const clip_vertex_t* a, const clip_vertex_t* b, float t) {
+    clip_vertex_t v = {
+        .position = {
+            a->position.x + (b->position.x - a->position.x) * t,
+            a->position.y + (b->position.y - a->position.y) * t,
+            a->position.z + (b->position.z - a->position.z) * t,
+            a->position.w + (b->position.w - a->position.w) * t
+        },
+        .uv = {a->uv.u + (b->uv.u - a->uv.u) * t, a->uv.v + (b->uv.v - a->uv.v) * t},
+        .corner = -1
+    };
+    return v;
+}
+
+int clip_polygon(clip_vertex_t* vertices, int num_vertices, int planes, float guard_x, float guard_y) {
+    // Sutherland-Hodgman: one plane at a time, walk the edges and keep what is inside
+    for (int plane = CLIP_NEAR; plane <= CLIP_BOTTOM && num_vertices > 0; plane <<= 1) {
+        if (!(planes & plane)) continue;
+
+        clip_vertex_t inside[CLIP_MAX_VERTICES];
+        int num_inside = 0;
+        const clip_vertex_t* previous = &vertices[num_vertices - 1];
+        float previous_distance = plane_distance(previous->position, plane, guard_x, guard_y);
+        for (int i = 0; i < num_vertices; i++) {
+            const clip_vertex_t* current = &vertices[i];
+            float distance = plane_distance(current->position, plane, guard_x, guard_y);
+            if ((previous_distance >= 0) != (distance >= 0)) {
+                // Always interpolate from the inside vertex, so both triangles sharing the edge get the same point
+                if (distance >= 0) {
+                    inside[num_inside++] = clip_vertex_lerp(current, previous, distance / (distance - previous_distance));
+                } else {
+                    inside[num_inside++] = clip_vertex_lerp(previous, current, previous_distance / (previous_distance - distance));
+                }
+            }
+            if (distance >= 0) {
+                inside[num_inside++] = *current;
+            }
+            previous = current;
+            previous_distance = distance;
+        }
+        for (int i = 0; i < num_inside; i++) {
+            vertices[i] = inside[i];
+        }
+        num_vertices = num_inside;
+    }
+    return (num_vertices >= 3) ? num_vertices : 0;
+}
+
+/**
+*    The planes of the frame and the near and far planes, as the weights of x, y, z and w of the clip space
+*    expression that is negative outside of each: z, w - z, x + w, w - x, w - y and y + w.
+**/
+static const vec4_t frustum_planes[6] = {
+    {0, 0, 1, 0}, {0, 0, -1, 1}, {1, 0, 0, 1}, {-1, 0, 0, 1}, {0, -1, 0, 1}, {0, 1, 0, 1}
+};
+
+void clip_frustum_planes(mat4_t proj_matrix, vec4_t planes[6]) {
+    for (int i = 0; i < 6; i++) {
+        // The clip space expression of the plane, pulled back through the projection
+        const vec4_t* weights = &frustum_planes[i];
+        float plane[4];
+        for (int c = 0; c < 4; c++) {
+            plane[c] = weights->x * proj_matrix.m[0][c] + weights->y * proj_matrix.m[1][c] +
+                weights->z * proj_matrix.m[2][c] + weights->w * proj_matrix.m[3][c];
+        }
+        float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        planes[i] = (vec4_t){plane[0] / length, plane[1] / length, plane[2] / length, plane[3] / length};
+    }
+}
+
+enum clip_volume_test clip_test_sphere(vec3_t center, float radius, const vec4_t planes[6]) {
+    bool inside = true;
+    for (int i = 0; i < 6; i++) {
+        float distance = planes[i].x * center.x + planes[i].y * center.y + planes[i].z * center.z + planes[i].w;
+        if (distance < -radius) return CLIP_VOLUME_OUTSIDE;
+        if (distance < radius) inside = false;
+    }
+    return inside ? CLIP_VOLUME_INSIDE : CLIP_VOLUME_CROSSING;
+}
+
+enum clip_volume_test clip_test_points(const vec4_t* points, int count) {
+    // The frame and near and far planes are the ones whose codes do not depend on the guard band
+    const int planes = CLIP_NEAR | CLIP_FAR | CLIP_FRAME_LEFT | CLIP_FRAME_RIGHT | CLIP_FRAME_TOP | CLIP_FRAME_BOTTOM;
+    int all_outside = planes;
+    int any_outside = 0;
+    for (int i = 0; i < count; i++) {
+        int codes = clip_point_codes(points[i], 1, 1) & planes;
+        all_outside &= codes;
+        any_outside |= codes;
+    }
+    if (all_outside) return CLIP_VOLUME_OUTSIDE;
+    return any_outside ? CLIP_VOLUME_CROSSING : CLIP_VOLUME_INSIDE;
+}
+
+vec4_t clip_to_screen(vec4_t position, int width, int height) {
+    float half_width = width / 2.0f;
+    float half_height = height / 2.0f;
+    vec4_t screen = position;
+    if (position.w != 0) {
+        screen.x /= position.w;
+        screen.y /= position.w;
+        screen.z /= position.w;
+    }
+    screen.x = screen.x * half_width + half_width;
+    screen.y = half_height - screen.y * half_height;
+    return screen;
+}
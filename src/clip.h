@@ -0,0 +1,99 @@
+#ifndef CLIP_H
+#define CLIP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "vector.h"
+#include "matrix.h"
+#include "texture.h"
+#include "triangle.h"
+
+/**
+*    Clip stage: triangles are clipped in clip space, before the divide by w, against the near and far
+*    planes (0 <= z <= w) and against a guard band in x and y, the part of clip space that lands within
+*    CLIP_GUARD_BAND pixels of the origin. The rasterizers restrict everything inside the guard band to the
+*    frame with their bounding boxes, so only triangles crossing the near or far plane or reaching very far
+*    off screen are ever split.
+*    Every vertex gets clip codes: one bit for each plane it lies outside of. Triangles whose vertices all
+*    lie outside one plane are rejected whole, which the sides of the frame itself take part in too.
+**/
+enum clip_plane {
+    CLIP_NEAR = 1 << 0,        // z < 0
+    CLIP_FAR = 1 << 1,         // z > w
+    CLIP_LEFT = 1 << 2,        // x < -guard_x * w
+    CLIP_RIGHT = 1 << 3,       // x > guard_x * w
+    CLIP_TOP = 1 << 4,         // y > guard_y * w
+    CLIP_BOTTOM = 1 << 5,      // y < -guard_y * w
+    CLIP_FRAME_LEFT = 1 << 6,  // x < -w: left of the frame, only for rejecting
+    CLIP_FRAME_RIGHT = 1 << 7, // x > w
+    CLIP_FRAME_TOP = 1 << 8,   // y > w
+    CLIP_FRAME_BOTTOM = 1 << 9 // y < -w
+};
+
+// Planes triangles are clipped against
+#define CLIP_PLANES (CLIP_NEAR | CLIP_FAR | CLIP_LEFT | CLIP_RIGHT | CLIP_TOP | CLIP_BOTTOM)
+
+// Clipped vertices stay this far inside the guard band of the rasterizers, which leaves room for rounding
+#define CLIP_GUARD_BAND (RASTER_GUARD_BAND - 16)
+
+// Most vertices a triangle can have after clipping: each of the 6 planes adds at most one
+#define CLIP_MAX_VERTICES 9
+
+// Most triangles the fan over a clipped triangle has
+#define CLIP_MAX_TRIANGLES (CLIP_MAX_VERTICES - 2)
+
+// Extent of the guard band along an axis of the frame of size pixels, in units of w
+static inline float clip_guard_band(int size) {
+    float half = size / 2.0f;
+    return (CLIP_GUARD_BAND - half) / half;
+}
+
+// Clip codes of a clip space position
+static inline uint16_t clip_point_codes(vec4_t p, float guard_x, float guard_y) {
+    return (p.z < 0 ? CLIP_NEAR : 0) | (p.z > p.w ? CLIP_FAR : 0) |
+        (p.x < -guard_x * p.w ? CLIP_LEFT : 0) | (p.x > guard_x * p.w ? CLIP_RIGHT : 0) |
+        (p.y > guard_y * p.w ? CLIP_TOP : 0) | (p.y < -guard_y * p.w ? CLIP_BOTTOM : 0) |
+        (p.x < -p.w ? CLIP_FRAME_LEFT : 0) | (p.x > p.w ? CLIP_FRAME_RIGHT : 0) |
+        (p.y > p.w ? CLIP_FRAME_TOP : 0) | (p.y < -p.w ? CLIP_FRAME_BOTTOM : 0);
+}
+
+typedef struct {
+    vec4_t position; // clip space
+    tex2_t uv;
+    int corner;      // the corner of the triangle the vertex is, or -1 for vertices made by clipping
+} clip_vertex_t;
+
+/**
+*    Clips the convex polygon of num_vertices vertices (CLIP_MAX_VERTICES of room) against the planes set
+*    in planes, interpolating the positions and texture coordinates of the vertices made on them.
+*    Returns the number of vertices left, 0 if none of the polygon is inside.
+**/
+int clip_polygon(clip_vertex_t* vertices, int num_vertices, int planes, float guard_x, float guard_y);
+
+// Where a whole mesh lies against the frame and the near and far planes
+enum clip_volume_test {
+    CLIP_VOLUME_OUTSIDE,  // wholly outside one of them: nothing of it can be seen
+    CLIP_VOLUME_CROSSING, // its faces need the clip stage
+    CLIP_VOLUME_INSIDE    // wholly inside all of them: none of its faces needs clipping or can be rejected
+};
+
+/**
+*    The frame and the near and far planes in the space proj_matrix projects from, each as (x, y, z, w) for
+*    the signed distance x * px + y * py + z * pz + w of a point p, positive inside.
+**/
+void clip_frustum_planes(mat4_t proj_matrix, vec4_t planes[6]);
+
+/**
+*    Tests the sphere of center and radius against the planes from clip_frustum_planes. Spheres are cheap
+*    to test but loose, so the test is conservative: spheres neither wholly outside nor wholly inside are
+*    CLIP_VOLUME_CROSSING.
+**/
+enum clip_volume_test clip_test_sphere(vec3_t center, float radius, const vec4_t planes[6]);
+
+// Tests the convex hull of count clip space points, such as the corners of a bounding box
+enum clip_volume_test clip_test_points(const vec4_t* points, int count);
+
+// Divides a clip space position by w and maps it to a frame of width x height pixels, like vertex_transform
+vec4_t clip_to_screen(vec4_t position, int width, int height);
+
+#endif
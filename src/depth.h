@@ -0,0 +1,101 @@
+#ifndef DEPTH_H
+#define DEPTH_H
+
+#include <stdint.h>
+
+/**
+*    Formats of the z-buffer, chosen at startup. Every format orders pixels by the depth 1 - 1/w, which
+*    grows with the distance, and the depth test keeps a pixel only if it is strictly nearer.
+*    float32: the depth itself.
+*    unorm24 and unorm16: 1 - depth_near/w, which goes from 0 at the near plane to 1 at infinity, as an
+*    unsigned integer of 24 bits (packed into 3 bytes) or 16 bits. They cut the depth traffic to 3/4 or 1/2
+*    of float32, at the cost of depths closer than one step of the format comparing equal: the one drawn
+*    later then loses the depth test, even where it is the nearer one (a depth fight).
+**/
+enum depth_format {
+    DEPTH_FORMAT_FLOAT32,
+    DEPTH_FORMAT_UNORM24,
+    DEPTH_FORMAT_UNORM16
+};
+
+extern enum depth_format depth_format; // format of z_buffer
+extern float depth_near; // distance of the near plane, which the unorm formats map to 0
+
+// Bytes per pixel of a z-buffer in format
+static inline int depth_format_size(enum depth_format format) {
+    if (format == DEPTH_FORMAT_UNORM24) return 3;
+    if (format == DEPTH_FORMAT_UNORM16) return 2;
+    return 4;
+}
+
+// Largest value of a unorm format, which is also its clear value: every bit set
+static inline uint32_t depth_unorm_max(enum depth_format format) {
+    return (format == DEPTH_FORMAT_UNORM24) ? 0xFFFFFF : 0xFFFF;
+}
+
+/**
+*    The unorm value of a depth is (1 - depth_near/w) * max = depth * scale + bias, clamped to 0..max and
+*    truncated. Truncation makes every depth below depth_decode(format, value) encode below value.
+**/
+static inline float depth_unorm_scale(enum depth_format format) {
+    return depth_near * (float)depth_unorm_max(format);
+}
+
+static inline float depth_unorm_bias(enum depth_format format) {
+    return (1 - depth_near) * (float)depth_unorm_max(format);
+}
+
+static inline uint32_t depth_encode(enum depth_format format, float depth) {
+    float value = depth * depth_unorm_scale(format) + depth_unorm_bias(format);
+    // NaN takes the farthest value, which fails the depth test like it does in float32
+    if (!(value < (float)depth_unorm_max(format))) return depth_unorm_max(format);
+    if (value < 0) value = 0;
+    return (uint32_t)value;
+}
+
+static inline float depth_decode(enum depth_format format, uint32_t value) {
+    return ((float)value - depth_unorm_bias(format)) / depth_unorm_scale(format);
+}
+
+// Unorm value of pixel index of depths
+static inline uint32_t depth_load_unorm(enum depth_format format, const void* depths, int index) {
+    if (format == DEPTH_FORMAT_UNORM16) return ((const uint16_t*)depths)[index];
+    const uint8_t* bytes = (const uint8_t*)depths + (index * 3);
+    return bytes[0] | (bytes[1] << 8) | ((uint32_t)bytes[2] << 16);
+}
+
+static inline void depth_store_unorm(enum depth_format format, void* depths, int index, uint32_t value) {
+    if (format == DEPTH_FORMAT_UNORM16) {
+        ((uint16_t*)depths)[index] = (uint16_t)value;
+        return;
+    }
+    uint8_t* bytes = (uint8_t*)depths + (index * 3);
+    bytes[0] = value & 0xFF;
+    bytes[1] = (value >> 8) & 0xFF;
+    bytes[2] = (value >> 16) & 0xFF;
+}
+
+/**
+*    Compares depth with pixel index of depths in the precision of format: negative if depth is nearer
+*    (it passes the depth test), 0 if the two are equal and positive if depth is farther. NaN is never
+*    nearer: it compares as the farthest depth in every format.
+**/
+static inline int depth_compare(enum depth_format format, const void* depths, int index, float depth) {
+    if (format == DEPTH_FORMAT_FLOAT32) {
+        float stored = ((const float*)depths)[index];
+        return (depth < stored) ? -1 : (depth == stored) ? 0 : 1;
+    }
+    uint32_t value = depth_encode(format, depth);
+    uint32_t stored = depth_load_unorm(format, depths, index);
+    return (value < stored) ? -1 : (value == stored) ? 0 : 1;
+}
+
+static inline void depth_store(enum depth_format format, void* depths, int index, float depth) {
+    if (format == DEPTH_FORMAT_FLOAT32) {
+        ((float*)depths)[index] = depth;
+        return;
+    }
+    depth_store_unorm(format, depths, index, depth_encode(format, depth));
+}
+
+#endif
@@ -1,30 +1,65 @@
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "display.h"
+#include "presenter.h"
+#include "array.h"
 
 int window_width = -1;
 int window_height = -1;
+int window_pitch = -1;
+int buffer_length = 0;
+enum buffer_layout buffer_layout = BUFFER_LAYOUT_LINEAR;
+enum depth_format depth_format = DEPTH_FORMAT_FLOAT32;
+float depth_near = 0.1f;
+
+// Draw straight into the locked streaming texture instead of copying the color buffer into it every frame
+bool zero_copy_present = true;
+
+// Bytes of color buffer copied into the texture since the start
+int64_t uploaded_bytes = 0;
 
 SDL_Window* window = NULL;
 SDL_Renderer* renderer = NULL;
 
 uint32_t* color_buffer = NULL;
-float* z_buffer = NULL;
+void* z_buffer = NULL;
+
+// Index into triangles_to_render of the visible triangle at every pixel, for the deferred texturing mode
+uint32_t* visibility_buffer = NULL;
+
+// Hierarchical z-buffer: the farthest depth stored in each HIZ_BLOCK_SIZE x HIZ_BLOCK_SIZE block of z_buffer
+float* hiz_buffer = NULL;
+int hiz_width = 0;
+int hiz_height = 0;
 SDL_Texture* color_buffer_texture = NULL;
 
-bool initialize_window(void) {
+/**
+*    Opens the SDL window for frames of width x height, and the texture they are streamed through.
+*    A size of 0 sizes the window to the fullscreen resolution and returns that size.
+*    pitch returns the row pitch (in pixels) the render target needs for drawing into the locked texture.
+**/
+bool initialize_window(int* width, int* height, int* pitch) {
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
         fprintf(stderr, "Error initializing SDL.\n");
         return false;
     }
 
     // Use SDL to query what is the fullscreen max. width and height
-    SDL_DisplayMode display_mode;
-    SDL_GetCurrentDisplayMode(
-        0,                      // Display index (0 for default)
-        &display_mode           // Pointer to display_mode struct
-    );
-    window_width = display_mode.w;
-    window_height = display_mode.h;
+    if (*width <= 0 || *height <= 0) {
+        SDL_DisplayMode display_mode;
+        SDL_GetCurrentDisplayMode(
+            0,                      // Display index (0 for default)
+            &display_mode           // Pointer to display_mode struct
+        );
+        *width = display_mode.w;
+        *height = display_mode.h;
+    }
+    window_width = *width;
+    window_height = *height;
 
     // Create an SDL Window
     window = SDL_CreateWindow(
@@ -54,10 +89,46 @@ bool initialize_window(void) {
     //     return false;
     // }
 
+    // Frames drawn below the window size are stretched over the window with bilinear filtering
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+
+    // Creating an SDL texture to display the color buffer
+    color_buffer_texture = SDL_CreateTexture(
+        renderer,
+        SDL_PIXELFORMAT_RGBA32,
+        SDL_TEXTUREACCESS_STREAMING,
+        window_width,
+        window_height
+    );
+    if (!color_buffer_texture) {
+        fprintf(stderr, "Error creating color_buffer texture.\n");
+        return false;
+    }
+
+    // The texture rows may be padded, and the render target rows have to match them for zero-copy drawing
+    *pitch = window_width;
+    if (zero_copy_present) {
+        void* pixels;
+        int pitch_bytes;
+        if (SDL_LockTexture(color_buffer_texture, NULL, &pixels, &pitch_bytes) < 0) {
+            zero_copy_present = false;
+        } else {
+            SDL_UnlockTexture(color_buffer_texture);
+            if (pitch_bytes % sizeof(uint32_t) == 0) {
+                *pitch = pitch_bytes / sizeof(uint32_t);
+            } else {
+                zero_copy_present = false;
+            }
+        }
+    }
+
     return true;
 }
 
 void destroy_window(void) {
+    if (color_buffer_texture) {
+        SDL_DestroyTexture(color_buffer_texture);
+    }
     if (renderer) {
         SDL_DestroyRenderer(renderer);
     }
@@ -67,74 +138,485 @@ void destroy_window(void) {
     SDL_Quit();
 }
 
-bool render_color_buffer(void) {
-    int success = 0;
-    success = SDL_UpdateTexture(
-        color_buffer_texture,
-        NULL,
-        color_buffer,
-        (int) (window_width * sizeof(uint32_t))
-    );
-    if (success < 0) {
-        fprintf(stderr, "Error rendering color_buffer: UpdateTexture\n");
-        return false;
+/**
+*    Points the color buffer of target at the pixels of the locked streaming texture, so the frame is drawn
+*    right where SDL reads it from. The locked pixels are write-only: they do not keep the previous frame.
+*    Falls back to drawing into the render target's own color buffer (and copying it) if locking fails.
+**/
+bool lock_color_buffer(render_target_t* target) {
+    target->color_buffer = target->color_storage;
+    target->color_borrowed = false;
+    if (!zero_copy_present) return true;
+
+    void* pixels;
+    int pitch_bytes;
+    if (SDL_LockTexture(color_buffer_texture, NULL, &pixels, &pitch_bytes) < 0) {
+        fprintf(stderr, "Error locking color_buffer texture, falling back to copying the color buffer.\n");
+        zero_copy_present = false;
+        return true;
     }
-    success = SDL_RenderCopy(
-        renderer,
-        color_buffer_texture,
-        NULL,
-        NULL
-    );
-    if (success < 0) {
+    if (pitch_bytes != (int) (target->pitch * sizeof(uint32_t))) {
+        fprintf(stderr, "color_buffer texture pitch changed, falling back to copying the color buffer.\n");
+        SDL_UnlockTexture(color_buffer_texture);
+        zero_copy_present = false;
+        return true;
+    }
+    target->color_buffer = (uint32_t*) pixels;
+    target->color_borrowed = true;
+    return true;
+}
+
+/**
+*    Copies the pixels of rect in the color buffer of target into rows pitch_bytes apart, starting at rows,
+*    which is where the top left pixel of rect goes. Tiled buffers are detiled on the way, one micro-tile
+*    row at a time: the one detile step of a frame.
+**/
+static void copy_color_rect(const render_target_t* target, rect_t rect, void* rows, int pitch_bytes) {
+    for (int y = rect.min_y; y <= rect.max_y; y++) {
+        uint32_t* row = (uint32_t*) ((uint8_t*) rows + (size_t) (y - rect.min_y) * pitch_bytes) - rect.min_x;
+        if (target->layout != BUFFER_LAYOUT_TILED) {
+            memcpy(&row[rect.min_x], &target->color_buffer[(size_t) target->pitch * y + rect.min_x], sizeof(uint32_t) * (rect.max_x - rect.min_x + 1));
+            continue;
+        }
+        int x = rect.min_x;
+        while (x <= rect.max_x) {
+            int run_end = ((x | (HIZ_BLOCK_SIZE - 1)) < rect.max_x) ? (x | (HIZ_BLOCK_SIZE - 1)) : rect.max_x;
+            memcpy(&row[x], &target->color_buffer[buffer_index(BUFFER_LAYOUT_TILED, target->pitch, x, y)], sizeof(uint32_t) * (run_end - x + 1));
+            x = run_end + 1;
+        }
+    }
+}
+
+// Copies the changed pixels of a tiled color buffer straight into the locked texture memory
+static int detile_color_buffer(const render_target_t* target, rect_t changed, const SDL_Rect* texture_rect) {
+    void* pixels;
+    int pitch_bytes;
+    if (SDL_LockTexture(color_buffer_texture, texture_rect, &pixels, &pitch_bytes) < 0) {
+        return -1;
+    }
+    copy_color_rect(target, changed, pixels, pitch_bytes);
+    SDL_UnlockTexture(color_buffer_texture);
+    return 0;
+}
+
+static SDL_Rect texture_rect_of(rect_t rect) {
+    SDL_Rect texture_rect = {rect.min_x, rect.min_y, rect.max_x - rect.min_x + 1, rect.max_y - rect.min_y + 1};
+    return texture_rect;
+}
+
+// Shows the top left width x height pixels of the texture, scaled up to the whole window if they are fewer
+static bool present_texture(int width, int height) {
+    SDL_Rect frame_rect = {0, 0, width, height};
+    if (SDL_RenderCopy(renderer, color_buffer_texture, &frame_rect, NULL) < 0) {
         fprintf(stderr, "Error rendering color_buffer: RenderCopy\n");
         return false;
     }
-    
+    SDL_RenderPresent(renderer);
     return true;
 }
 
-void clear_color_buffer(uint32_t color) {
-    for (int y = 0; y < window_height; y++) {
-        for (int x = 0; x < window_width; x++) {
-            draw_pixel(x, y, color);
+bool render_color_buffer(const render_target_t* target) {
+    int success = 0;
+    if (target->color_borrowed) {
+        // The frame is already in the texture
+        SDL_UnlockTexture(color_buffer_texture);
+    }
+    // Otherwise only upload the pixels that changed, the texture still holds the rest from the last frame
+    for (int i = 0; !target->color_borrowed && i < array_length(target->changed); i++) {
+        rect_t changed = target->changed[i];
+        SDL_Rect texture_rect = texture_rect_of(changed);
+        if (target->layout == BUFFER_LAYOUT_TILED) {
+            success = detile_color_buffer(target, changed, &texture_rect);
+        } else {
+            success = SDL_UpdateTexture(
+                color_buffer_texture,
+                &texture_rect,
+                &target->color_buffer[(target->pitch * changed.min_y) + changed.min_x],
+                (int) (target->pitch * sizeof(uint32_t))
+            );
+        }
+        if (success < 0) {
+            fprintf(stderr, "Error rendering color_buffer: UpdateTexture\n");
+            return false;
+        }
+        uploaded_bytes += (int64_t) texture_rect.w * texture_rect.h * sizeof(uint32_t);
+    }
+    return present_texture(target->width, target->height);
+}
+
+const presenter_t sdl_presenter = {
+    initialize_window,
+    lock_color_buffer,
+    render_color_buffer,
+    destroy_window,
+    true,
+    true
+};
+
+/**
+*    Sets count 32-bit values starting at buffer to bits, 16 bytes per store where SSE2 is available.
+*    Streaming (non-temporal) stores bypass the caches, which suits whole buffers that are much larger than
+*    the caches and are not read again before the next frame draws into them.
+**/
+static void fill_32(void* buffer, uint32_t bits, int count, bool streaming) {
+    uint32_t* values = (uint32_t*) buffer;
+    int i = 0;
+#if defined(__SSE2__)
+    // Scalar stores up to the first 16 byte boundary, which the vector stores need
+    while (i < count && ((uintptr_t)&values[i] & 15)) {
+        values[i++] = bits;
+    }
+    __m128i vector = _mm_set1_epi32((int)bits);
+    if (streaming) {
+        for (; i + 4 <= count; i += 4) {
+            _mm_stream_si128((__m128i*)&values[i], vector);
+        }
+        // Make the write-combined stores visible before anything else touches the buffer
+        _mm_sfence();
+    } else {
+        for (; i + 4 <= count; i += 4) {
+            _mm_store_si128((__m128i*)&values[i], vector);
         }
     }
+#endif
+    for (; i < count; i++) {
+        values[i] = bits;
+    }
+}
+
+static uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+void clear_color_buffer(uint32_t color) {
+    fill_32(color_buffer, color, buffer_length, true);
 }
 
 void clear_z_buffer() {
-    for (int y = 0; y < window_height; y++) {
-        for (int x = 0; x < window_width; x++) {
-           z_buffer[(window_width * y) + x] = 1.0; 
+    if (depth_format == DEPTH_FORMAT_FLOAT32) {
+        fill_32(z_buffer, float_bits(1.0), buffer_length, true);
+    } else {
+        // The unorm clear value has every bit set, so the buffer is filled as words and then bytes
+        int num_bytes = buffer_length * depth_format_size(depth_format);
+        fill_32(z_buffer, 0xFFFFFFFF, num_bytes / 4, true);
+        memset((uint8_t*)z_buffer + (num_bytes & ~3), 0xFF, num_bytes & 3);
+    }
+    fill_32(hiz_buffer, float_bits(1.0), hiz_width * hiz_height, false);
+}
+
+/**
+*    Sets the pixels of rect in a per-pixel buffer with regular stores, as the runs are short: whole block
+*    aligned micro-tiles at once in the tiled layout, row by row otherwise.
+**/
+static void fill_rect_32(void* buffer, rect_t rect, uint32_t bits) {
+    uint32_t* values = (uint32_t*) buffer;
+    int run_width = rect.max_x - rect.min_x + 1;
+    if (buffer_layout == BUFFER_LAYOUT_TILED && rect.min_x % HIZ_BLOCK_SIZE == 0 && rect.min_y % HIZ_BLOCK_SIZE == 0 &&
+        run_width % HIZ_BLOCK_SIZE == 0 && (rect.max_y + 1) % HIZ_BLOCK_SIZE == 0) {
+        for (int y = rect.min_y; y <= rect.max_y; y += HIZ_BLOCK_SIZE) {
+            fill_32(&values[pixel_index(rect.min_x, y)], bits, run_width * HIZ_BLOCK_SIZE, false);
+        }
+        return;
+    }
+    for (int y = rect.min_y; y <= rect.max_y; y++) {
+        for (int x = rect.min_x; x <= rect.max_x;) {
+            int run_end = pixel_run_end(x, rect.max_x);
+            fill_32(&values[pixel_index(x, y)], bits, run_end - x + 1, false);
+            x = run_end + 1;
+        }
+    }
+}
+
+// Sets every bit of the unorm depths of rect, in runs like fill_rect_32
+static void fill_depth_rect_unorm(rect_t rect) {
+    int size = depth_format_size(depth_format);
+    int run_width = rect.max_x - rect.min_x + 1;
+    if (buffer_layout == BUFFER_LAYOUT_TILED && rect.min_x % HIZ_BLOCK_SIZE == 0 && rect.min_y % HIZ_BLOCK_SIZE == 0 &&
+        run_width % HIZ_BLOCK_SIZE == 0 && (rect.max_y + 1) % HIZ_BLOCK_SIZE == 0) {
+        for (int y = rect.min_y; y <= rect.max_y; y += HIZ_BLOCK_SIZE) {
+            memset(depth_address(pixel_index(rect.min_x, y)), 0xFF, size * run_width * HIZ_BLOCK_SIZE);
+        }
+        return;
+    }
+    for (int y = rect.min_y; y <= rect.max_y; y++) {
+        for (int x = rect.min_x; x <= rect.max_x;) {
+            int run_end = pixel_run_end(x, rect.max_x);
+            memset(depth_address(pixel_index(x, y)), 0xFF, size * (run_end - x + 1));
+            x = run_end + 1;
+        }
+    }
+}
+
+// Clears only the pixels of rect
+void clear_color_buffer_rect(rect_t rect, uint32_t color) {
+    fill_rect_32(color_buffer, rect, color);
+}
+
+// Clears the depth of the pixels of rect, and the hierarchical z blocks that rect covers (rect must be block aligned)
+void clear_z_buffer_rect(rect_t rect) {
+    if (depth_format == DEPTH_FORMAT_FLOAT32) {
+        fill_rect_32(z_buffer, rect, float_bits(1.0));
+    } else {
+        fill_depth_rect_unorm(rect);
+    }
+    for (int by = rect.min_y / HIZ_BLOCK_SIZE; by <= rect.max_y / HIZ_BLOCK_SIZE; by++) {
+        for (int bx = rect.min_x / HIZ_BLOCK_SIZE; bx <= rect.max_x / HIZ_BLOCK_SIZE; bx++) {
+            hiz_buffer[(hiz_width * by) + bx] = 1.0;
+        }
+    }
+}
+
+/**
+*    Whether everything drawn inside rect with depths of at least min_depth is guaranteed to fail the
+*    depth test, because every hierarchical z block that rect touches is already nearer than min_depth.
+**/
+bool hiz_rejects(rect_t rect, float min_depth) {
+    for (int by = rect.min_y / HIZ_BLOCK_SIZE; by <= rect.max_y / HIZ_BLOCK_SIZE; by++) {
+        for (int bx = rect.min_x / HIZ_BLOCK_SIZE; bx <= rect.max_x / HIZ_BLOCK_SIZE; bx++) {
+            if (min_depth < hiz_buffer[(hiz_width * by) + bx]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+*    Recomputes the farthest depth of a block after pixels of it were written.
+*    Depths only ever decrease between clears, so a block that is not updated keeps a conservative value.
+**/
+void hiz_update_block(int block_x, int block_y) {
+    int x_start = block_x * HIZ_BLOCK_SIZE;
+    int y_start = block_y * HIZ_BLOCK_SIZE;
+    int x_end = (x_start + HIZ_BLOCK_SIZE < window_width) ? x_start + HIZ_BLOCK_SIZE : window_width;
+    int y_end = (y_start + HIZ_BLOCK_SIZE < window_height) ? y_start + HIZ_BLOCK_SIZE : window_height;
+
+    if (depth_format == DEPTH_FORMAT_FLOAT32) {
+        const float* depths = (const float*) z_buffer;
+        float max_depth = 0;
+        for (int y = y_start; y < y_end; y++) {
+            for (int x = x_start; x < x_end; x++) {
+                float depth = depths[pixel_index(x, y)];
+                if (depth > max_depth) max_depth = depth;
+            }
+        }
+        hiz_buffer[(hiz_width * block_y) + block_x] = max_depth;
+        return;
+    }
+
+    uint32_t max_value = 0;
+    for (int y = y_start; y < y_end; y++) {
+        for (int x = x_start; x < x_end; x++) {
+            uint32_t value = depth_load_unorm(depth_format, z_buffer, pixel_index(x, y));
+            if (value > max_value) max_value = value;
         }
     }
+    // One step farther than the farthest value, so rounding in depth_encode never makes it too near
+    hiz_buffer[(hiz_width * block_y) + block_x] = depth_decode(depth_format, max_value + 1);
+}
+
+// Rectangle covering the whole color buffer
+rect_t screen_rect(void) {
+    rect_t rect = {0, 0, window_width - 1, window_height - 1};
+    return rect;
 }
 
 void draw_pixel(int x, int y, uint32_t color) {
     if (x >= 0 && y >= 0 && x < window_width && y < window_height) {
-        color_buffer[(window_width * y) + x] = color;
+        color_buffer[pixel_index(x, y)] = color;
+    }
+}
+
+/**
+*    Integer (Bresenham) walk of the part of a line that lies inside a clip rectangle.
+*    Step i of a line that is longer along x lights the pixel (x0 + i * sx, y0 + round(i * |dy| / |dx|) * sy),
+*    with x and y swapped for lines that are longer along y. Both coordinates are monotone in i, so the
+*    range of steps inside the clip rectangle is solved for exactly (Liang-Barsky on the integer step) and
+*    the walk starts there with the error term it would have had when stepping from (x0, y0). A line thus
+*    covers the same pixels however it is clipped, and the walk itself needs no bounds checks.
+**/
+typedef struct {
+    int x;              // first pixel inside the clip rectangle
+    int y;
+    int first_step;     // step number of that pixel
+    int num_steps;      // number of pixels inside the clip rectangle
+    int length;         // number of steps of the whole line, along its longer axis
+    int major_x;        // coordinate increments per step
+    int major_y;
+    int minor_x;        // additional increments whenever the shorter axis advances
+    int minor_y;
+    int64_t error;      // (2 * i * minor + major) mod (2 * major) at the first pixel
+    int64_t error_step; // 2 * minor
+    int64_t error_wrap; // 2 * major
+} line_walk_t;
+
+// End points must lie within this many pixels of the origin, which keeps the step arithmetic inside 64 bits
+#define LINE_GUARD_BAND (1 << 24)
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+static int64_t ceil_div(int64_t a, int64_t b) {
+    return -floor_div(-a, b);
+}
+
+// Range of offsets from start, in direction sign, that keep a coordinate within min..max
+static void line_axis_range(int start, int sign, int min, int max, int64_t* lo, int64_t* hi) {
+    *lo = (sign > 0) ? (int64_t)min - start : (int64_t)start - max;
+    *hi = (sign > 0) ? (int64_t)max - start : (int64_t)start - min;
+}
+
+static bool line_walk_setup(line_walk_t* walk, int x0, int y0, int x1, int y1, rect_t clip) {
+    if (abs(x0) > LINE_GUARD_BAND || abs(y0) > LINE_GUARD_BAND || abs(x1) > LINE_GUARD_BAND || abs(y1) > LINE_GUARD_BAND) return false;
+
+    // Cohen-Sutherland style trivial reject: both end points beyond the same side of the clip rectangle
+    if ((x0 < clip.min_x && x1 < clip.min_x) || (x0 > clip.max_x && x1 > clip.max_x)) return false;
+    if ((y0 < clip.min_y && y1 < clip.min_y) || (y0 > clip.max_y && y1 > clip.max_y)) return false;
+
+    int sx = (x1 < x0) ? -1 : 1;
+    int sy = (y1 < y0) ? -1 : 1;
+    int64_t dx = (int64_t)(x1 - x0) * sx;
+    int64_t dy = (int64_t)(y1 - y0) * sy;
+    bool x_major = (dx >= dy);
+    int64_t major = x_major ? dx : dy;
+    int64_t minor = x_major ? dy : dx;
+
+    // Steps that keep the longer axis inside the clip rectangle
+    int64_t step_lo, step_hi, minor_lo, minor_hi;
+    if (x_major) {
+        line_axis_range(x0, sx, clip.min_x, clip.max_x, &step_lo, &step_hi);
+        line_axis_range(y0, sy, clip.min_y, clip.max_y, &minor_lo, &minor_hi);
+    } else {
+        line_axis_range(y0, sy, clip.min_y, clip.max_y, &step_lo, &step_hi);
+        line_axis_range(x0, sx, clip.min_x, clip.max_x, &minor_lo, &minor_hi);
+    }
+    if (step_lo < 0) step_lo = 0;
+    if (step_hi > major) step_hi = major;
+
+    // Steps that keep the shorter axis inside, from round(i * minor / major) = floor((2 * i * minor + major) / (2 * major))
+    if (minor == 0) {
+        if (minor_lo > 0 || minor_hi < 0) return false;
+    } else {
+        int64_t lo = ceil_div(2 * major * minor_lo - major, 2 * minor);
+        int64_t hi = ceil_div(2 * major * (minor_hi + 1) - major, 2 * minor) - 1;
+        if (lo > step_lo) step_lo = lo;
+        if (hi < step_hi) step_hi = hi;
+    }
+    if (step_lo > step_hi) return false;
+
+    // A line of a single pixel never steps, but still needs a valid error wrap
+    int length = (int)major;
+    if (major == 0) major = 1;
+    int64_t numerator = 2 * step_lo * minor + major;
+    int64_t minor_offset = numerator / (2 * major);
+    int x = x_major ? x0 + sx * (int)step_lo : x0 + sx * (int)minor_offset;
+    int y = x_major ? y0 + sy * (int)minor_offset : y0 + sy * (int)step_lo;
+
+    walk->x = x;
+    walk->y = y;
+    walk->first_step = (int)step_lo;
+    walk->num_steps = (int)(step_hi - step_lo + 1);
+    walk->length = length;
+    walk->major_x = x_major ? sx : 0;
+    walk->major_y = x_major ? 0 : sy;
+    walk->minor_x = x_major ? 0 : sx;
+    walk->minor_y = x_major ? sy : 0;
+    walk->error = numerator - minor_offset * 2 * major;
+    walk->error_step = 2 * minor;
+    walk->error_wrap = 2 * major;
+    return true;
+}
+
+/**
+*    Draws the pixels of a line walk, optionally depth tested against a z_buffer in format with depth
+*    decreasing by depth_step per step.
+*    Always inlined with constant arguments, so every use compiles to a loop with only the work it needs:
+*    the linear layout steps the buffer index directly, the tiled layout steps x and y and maps them.
+**/
+static inline __attribute__((always_inline)) void line_walk_draw(
+    const line_walk_t* walk, uint32_t color, bool depth_tested, float depth, float depth_step,
+    enum buffer_layout layout, enum depth_format format
+) {
+    // Locals, as the stores to color_buffer could otherwise alias the globals
+    uint32_t* buffer = color_buffer;
+    const void* depths = z_buffer;
+    int pitch = window_pitch;
+    int x = walk->x;
+    int y = walk->y;
+    int index = buffer_index(layout, pitch, x, y);
+    int major_step = walk->major_x + walk->major_y * pitch;
+    int minor_step = walk->minor_x + walk->minor_y * pitch;
+    int64_t error = walk->error;
+    for (int i = 0; i < walk->num_steps; i++) {
+        if (!depth_tested || depth_compare(format, depths, index, depth) < 0) {
+            buffer[index] = color;
+        }
+        depth -= depth_step;
+        error += walk->error_step;
+        bool minor = (error >= walk->error_wrap);
+        if (minor) {
+            error -= walk->error_wrap;
+        }
+        if (layout == BUFFER_LAYOUT_TILED) {
+            x += walk->major_x + (minor ? walk->minor_x : 0);
+            y += walk->major_y + (minor ? walk->minor_y : 0);
+            index = buffer_index(layout, pitch, x, y);
+        } else {
+            index += major_step + (minor ? minor_step : 0);
+        }
+    }
+}
+
+// Depth tested line walk, instantiated for the format of z_buffer
+static inline __attribute__((always_inline)) void line_walk_draw_depth_tested(
+    const line_walk_t* walk, uint32_t color, float depth, float depth_step, enum buffer_layout layout
+) {
+    if (depth_format == DEPTH_FORMAT_UNORM24) {
+        line_walk_draw(walk, color, true, depth, depth_step, layout, DEPTH_FORMAT_UNORM24);
+    } else if (depth_format == DEPTH_FORMAT_UNORM16) {
+        line_walk_draw(walk, color, true, depth, depth_step, layout, DEPTH_FORMAT_UNORM16);
+    } else {
+        line_walk_draw(walk, color, true, depth, depth_step, layout, DEPTH_FORMAT_FLOAT32);
     }
 }
 
 /**
-*    Function for drawing a line using DDA algorithm.
+*    Function for drawing a line using an integer Bresenham walk.
 **/
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
-    int delta_x = (x1 - x0);
-    int delta_y = (y1 - y0);
+    draw_line_clipped(x0, y0, x1, y1, color, screen_rect());
+}
 
-    int side_length = (abs(delta_x) >= abs(delta_y)) ? abs(delta_x) : abs(delta_y);
+// Same as draw_line, but only the pixels inside clip are written
+void draw_line_clipped(int x0, int y0, int x1, int y1, uint32_t color, rect_t clip) {
+    line_walk_t walk;
+    if (!line_walk_setup(&walk, x0, y0, x1, y1, clip)) return;
 
-    // Find how much we should increment in both x and y each step
-    float x_inc = delta_x / (float) side_length;
-    float y_inc = delta_y / (float) side_length;
+    if (buffer_layout == BUFFER_LAYOUT_TILED) {
+        line_walk_draw(&walk, color, false, 0, 0, BUFFER_LAYOUT_TILED, DEPTH_FORMAT_FLOAT32);
+    } else {
+        line_walk_draw(&walk, color, false, 0, 0, BUFFER_LAYOUT_LINEAR, DEPTH_FORMAT_FLOAT32);
+    }
+}
 
-    float current_x = x0;
-    float current_y = y0;
+/**
+*    Depth tested variant of draw_line_clipped: the depth (1 - 1/w) is interpolated between the end points
+*    and pixels behind z_buffer are skipped, so edges hidden by filled triangles are not drawn. Lines do not
+*    write depth; LINE_DEPTH_BIAS keeps the edges of the visible triangles from fighting with their own fill.
+**/
+void draw_line_depth_clipped(int x0, int y0, float w0, int x1, int y1, float w1, uint32_t color, rect_t clip) {
+    line_walk_t walk;
+    if (!line_walk_setup(&walk, x0, y0, x1, y1, clip)) return;
 
-    for(int i = 0; i <= side_length; i++) {
-        draw_pixel(round(current_x), round(current_y), color);
-        current_x += x_inc;
-        current_y += y_inc;
+    float rw_step = (walk.length > 0) ? (1 / w1 - 1 / w0) / walk.length : 0;
+    float depth = 1 - (1 / w0 + rw_step * walk.first_step) - LINE_DEPTH_BIAS;
+    if (buffer_layout == BUFFER_LAYOUT_TILED) {
+        line_walk_draw_depth_tested(&walk, color, depth, rw_step, BUFFER_LAYOUT_TILED);
+    } else {
+        line_walk_draw_depth_tested(&walk, color, depth, rw_step, BUFFER_LAYOUT_LINEAR);
     }
 }
 
@@ -148,23 +630,41 @@ void draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
 *                                                                   currently only implemented for when thickness == 1, else ignored
 **/
 void draw_grid(int spacing, int thickness, uint32_t color, bool connected) {
+    draw_grid_clipped(spacing, thickness, color, connected, screen_rect());
+}
+
+// Same as draw_grid, but only the pixels inside clip are written
+void draw_grid_clipped(int spacing, int thickness, uint32_t color, bool connected, rect_t clip) {
     int jumpAmount = 1;
     if (!connected && thickness == 1) {
         jumpAmount = spacing;
     }
-    for (int y = 0; y < window_height; y+=jumpAmount) {
-        for (int x = 0; x < window_width; x+=jumpAmount) {
+    // Start at the first multiple of jumpAmount inside clip, so the grid lines up across clip rectangles
+    int x_start = ((clip.min_x + jumpAmount - 1) / jumpAmount) * jumpAmount;
+    int y_start = ((clip.min_y + jumpAmount - 1) / jumpAmount) * jumpAmount;
+    for (int y = y_start; y <= clip.max_y; y+=jumpAmount) {
+        for (int x = x_start; x <= clip.max_x; x+=jumpAmount) {
             if (y % spacing < thickness || x % spacing < thickness) {
-                draw_pixel(x, y, color);
+                color_buffer[pixel_index(x, y)] = color;
             }
         }
     }
 }
 
 void draw_rectangle(int x_start, int y_start, int width, int height, uint32_t color) {
-    for (int y = y_start; y < y_start + height; y++) {
-        for (int x = x_start; x < x_start + width; x++) {
-            draw_pixel(x, y, color);
+    draw_rectangle_clipped(x_start, y_start, width, height, color, screen_rect());
+}
+
+void draw_rectangle_clipped(int x_start, int y_start, int width, int height, uint32_t color, rect_t clip) {
+    int x_end = x_start + width - 1;
+    int y_end = y_start + height - 1;
+    if (x_start < clip.min_x) x_start = clip.min_x;
+    if (y_start < clip.min_y) y_start = clip.min_y;
+    if (x_end > clip.max_x) x_end = clip.max_x;
+    if (y_end > clip.max_y) y_end = clip.max_y;
+    for (int y = y_start; y <= y_end; y++) {
+        for (int x = x_start; x <= x_end; x++) {
+            color_buffer[pixel_index(x, y)] = color;
         }
     }
 }
\ No newline at end of file
@@ -5,29 +5,119 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <SDL2/SDL.h>
+#include "depth.h"
 
 #define FPS 60
 #define FRAME_TARGET_TIME (1000 / FPS)
 
+// Size of the square screen tiles used for binning and for anchoring the rasterizers
+#define TILE_SIZE 64
+
+// Value of visibility_buffer pixels that no triangle covers
+#define VISIBILITY_NONE 0xFFFFFFFF
+
+// Size of the square pixel blocks summarized by one entry of the hierarchical z-buffer
+#define HIZ_BLOCK_SIZE 8
+
+// Depth offset towards the camera for depth tested lines, so they win against the triangle they outline
+#define LINE_DEPTH_BIAS 0.001f
+
+/**
+*    Memory layouts of the per-pixel buffers (color_buffer, z_buffer, visibility_buffer).
+*    Linear: row after row, window_pitch pixels apart.
+*    Tiled: HIZ_BLOCK_SIZE x HIZ_BLOCK_SIZE micro-tiles of 64 contiguous pixels (row-major inside the tile),
+*    stored row-major across the screen. A raster block (and its hierarchical z entry) is then exactly one
+*    micro-tile: 4 cache lines, on one page, instead of 8 rows that are each window_pitch pixels apart.
+*    Rows inside a micro-tile stay contiguous, so the span kernels work on both layouts unchanged.
+**/
+enum buffer_layout {
+    BUFFER_LAYOUT_LINEAR,
+    BUFFER_LAYOUT_TILED
+};
+
 typedef uint32_t color_t; //TODO:: Convert all color values typed as uint32_t to color_t
 
+// Inclusive pixel rectangle used to restrict drawing to part of the color buffer
+typedef struct {
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+} rect_t;
+
 extern int window_width;
 extern int window_height;
+extern int window_pitch; // pixels from one row of color_buffer, z_buffer and visibility_buffer to the next
+extern int buffer_length; // number of pixels in each of those buffers, padding included
+extern enum buffer_layout buffer_layout;
 extern SDL_Window* window;
 extern SDL_Renderer* renderer;
 extern uint32_t* color_buffer;
-extern float* z_buffer;
+extern void* z_buffer; // depth_format values
+extern uint32_t* visibility_buffer;
+extern float* hiz_buffer;
+extern int hiz_width;
+extern int hiz_height;
 extern SDL_Texture* color_buffer_texture;
+extern bool zero_copy_present;
+extern int64_t uploaded_bytes;
+
+typedef struct render_target_t render_target_t;
 
-bool initialize_window(void);
+// Index of pixel (x, y) in a buffer of the given layout and pitch (a multiple of HIZ_BLOCK_SIZE when tiled)
+static inline int buffer_index(enum buffer_layout layout, int pitch, int x, int y) {
+    if (layout == BUFFER_LAYOUT_TILED) {
+        int tile_offset = ((y & ~(HIZ_BLOCK_SIZE - 1)) * pitch) + ((x & ~(HIZ_BLOCK_SIZE - 1)) * HIZ_BLOCK_SIZE);
+        return tile_offset + ((y & (HIZ_BLOCK_SIZE - 1)) * HIZ_BLOCK_SIZE) + (x & (HIZ_BLOCK_SIZE - 1));
+    }
+    return (pitch * y) + x;
+}
+
+// Index of pixel (x, y) in color_buffer, z_buffer and visibility_buffer
+static inline int pixel_index(int x, int y) {
+    return buffer_index(buffer_layout, window_pitch, x, y);
+}
+
+// Address of the value of pixel index in z_buffer, e.g. depth_address(block_row_index(block_x, y))
+static inline void* depth_address(int index) {
+    return (uint8_t*)z_buffer + ((size_t)index * depth_format_size(depth_format));
+}
+
+// Last pixel of the run of contiguous pixels that starts at (x, y) and ends at (max_x, y) at the latest
+static inline int pixel_run_end(int x, int max_x) {
+    if (buffer_layout == BUFFER_LAYOUT_TILED && (x | (HIZ_BLOCK_SIZE - 1)) < max_x) {
+        return x | (HIZ_BLOCK_SIZE - 1);
+    }
+    return max_x;
+}
+
+/**
+*    Index that the x coordinates of row y inside the raster block starting at block_x are added to:
+*    &buffer[block_row_index(block_x, y)] works as a row pointer for the pixels of that block.
+**/
+static inline int block_row_index(int block_x, int y) {
+    return pixel_index(block_x, y) - block_x;
+}
+
+bool initialize_window(int* width, int* height, int* pitch);
 void destroy_window(void);
 
-bool render_color_buffer(void);
+bool lock_color_buffer(render_target_t* target);
+bool render_color_buffer(const render_target_t* target);
 void clear_color_buffer(uint32_t color);
 void clear_z_buffer();
+void clear_color_buffer_rect(rect_t rect, uint32_t color);
+void clear_z_buffer_rect(rect_t rect);
+
+bool hiz_rejects(rect_t rect, float min_depth);
+void hiz_update_block(int block_x, int block_y);
+
+rect_t screen_rect(void);
 
 void draw_pixel(int x, int y, uint32_t color);
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color);
+void draw_line_clipped(int x0, int y0, int x1, int y1, uint32_t color, rect_t clip);
+void draw_line_depth_clipped(int x0, int y0, float w0, int x1, int y1, float w1, uint32_t color, rect_t clip);
 /**
 *    Function for superimposing a black grid on top of a color buffer.
 *    TODO:: connected: true: grid is connected; false: grid is not (dot spaced grid)
@@ -36,6 +126,8 @@ void draw_line(int x0, int y0, int x1, int y1, uint32_t color);
 *                                                                   and thickness of n + 1 is n + 1 pixels)    
 **/
 void draw_grid(int spacing, int thickness, uint32_t color, bool connected); // TODO:: can we have optional parameters with default values in c
+void draw_grid_clipped(int spacing, int thickness, uint32_t color, bool connected, rect_t clip);
 void draw_rectangle(int x_start, int y_start, int width, int height, uint32_t color);
+void draw_rectangle_clipped(int x_start, int y_start, int width, int height, uint32_t color, rect_t clip);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include <math.h>
+#include "dynamic_resolution.h"
+
+// Fraction of the target the new scale aims at, which leaves room for frames slower than the average
+#define TARGET_HEADROOM 0.9
+// Average frame time below which the scale rises, as a fraction of the target
+#define RAISE_THRESHOLD 0.75
+// Largest rise of the scale in one step
+#define MAX_RAISE 1.1f
+// Scales are multiples of 1/SCALE_STEPS, so small changes in the frame time do not resize the frame
+#define SCALE_STEPS 64
+
+void dynamic_resolution_init(dynamic_resolution_t* resolution, double target_ms) {
+    resolution->target_ms = target_ms;
+    resolution->scale = 1;
+    resolution->average_ms = 0;
+    resolution->num_frames = 0;
+}
+
+bool dynamic_resolution_update(dynamic_resolution_t* resolution, double frame_ms) {
+    // Exponential moving average, started from the first frame at this scale
+    resolution->num_frames++;
+    if (resolution->num_frames == 1) {
+        resolution->average_ms = frame_ms;
+    } else {
+        resolution->average_ms += (frame_ms - resolution->average_ms) * 0.1;
+    }
+    if (resolution->num_frames < DYNAMIC_RESOLUTION_SETTLE_FRAMES || resolution->average_ms <= 0) {
+        return false;
+    }
+
+    double average_ms = resolution->average_ms;
+    if (average_ms <= resolution->target_ms && average_ms >= resolution->target_ms * RAISE_THRESHOLD) {
+        return false;
+    }
+    float scale = resolution->scale * sqrtf((float)(resolution->target_ms * TARGET_HEADROOM / average_ms));
+    if (scale > resolution->scale * MAX_RAISE) scale = resolution->scale * MAX_RAISE;
+    scale = floorf(scale * SCALE_STEPS) / SCALE_STEPS;
+    if (scale < DYNAMIC_RESOLUTION_MIN_SCALE) scale = DYNAMIC_RESOLUTION_MIN_SCALE;
+    if (scale > 1) scale = 1;
+    if (scale == resolution->scale) {
+        return false;
+    }
+    resolution->scale = scale;
+    resolution->num_frames = 0;
+    return true;
+}
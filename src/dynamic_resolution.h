@@ -0,0 +1,32 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <stdbool.h>
+
+// Smallest fraction of the window width and height frames are drawn at
+#define DYNAMIC_RESOLUTION_MIN_SCALE 0.5f
+
+// Frames measured at a scale before it may change again
+#define DYNAMIC_RESOLUTION_SETTLE_FRAMES 10
+
+/**
+*    Dynamic resolution: picks the fraction of the window size frames are drawn at from the measured frame
+*    times, so that frames stay within target_ms when the scene gets heavier and go back to the full size
+*    when it gets lighter. Presenting scales the frame up to the window.
+*    The frame time is taken to grow with the pixel count, the square of the scale: scale drops at once
+*    when frames are over the target, and only rises a step at a time when they are well below it, so it
+*    does not oscillate around the target.
+**/
+typedef struct {
+    double target_ms;
+    float scale;       // DYNAMIC_RESOLUTION_MIN_SCALE..1
+    double average_ms; // smoothed frame time at the current scale
+    int num_frames;    // frames measured at the current scale
+} dynamic_resolution_t;
+
+void dynamic_resolution_init(dynamic_resolution_t* resolution, double target_ms);
+
+// Adds the time of a frame drawn at the current scale; returns whether the scale changed
+bool dynamic_resolution_update(dynamic_resolution_t* resolution, double frame_ms);
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <SDL2/SDL.h>
 
 #include "array.h"
@@ -12,25 +14,118 @@
 #include "texture.h"
 #include "mesh.h"
 #include "upng.h"
+#include "tiler.h"
+#include "visibility.h"
+#include "sort.h"
+#include "span.h"
+#include "pipeline.h"
+#include "render_target.h"
+#include "presenter.h"
+#include "present_thread.h"
+#include "background.h"
+#include "dynamic_resolution.h"
+#include "vertex.h"
+#include "clip.h"
 
 enum cull_method {
     CULL_NONE,
     CULL_BACKFACE
 } cull_method;
 
-enum render_method {
-    RENDER_WIRE,
-    RENDER_WIRE_VERTEX,
-    RENDER_FILL_TRIANGLE,
-    RENDER_FILL_TRIANGLE_WIRE,
-    RENDER_TEXTURED,
-    RENDER_TEXTURED_WIRE
-} render_method;
-
-#define MAX_TRIANGLES_PER_MESH 10000
-triangle_t triangles_to_render[MAX_TRIANGLES_PER_MESH];
+enum render_method render_method;
+enum texture_wrap texture_wrap = TEXTURE_WRAP_REPEAT;
+bool wireframe_depth_test = false;
+
+// Layer under every frame: a lightgrey grid of dots on black, or the PNG image given with --background
+const char* background_filename = NULL;
+upng_t* background_png = NULL;
+
+// Clear only the tiles that were drawn into, instead of the whole color and depth buffers every frame
+bool lazy_clear = false;
+
+// Triangles of the frame, an array.h array with room for the fans of all visible faces if every one was clipped
+triangle_t* triangles_to_render = NULL;
 int num_triangles_to_render = 0;
 
+// Post-transform vertex cache: every vertex of the mesh transformed into world space and projected to the
+// screen once per frame, which the faces then index into instead of transforming each of their corners
+vertex_stream_t world_vertices;
+vertex_stream_t screen_vertices; // screen space, with w kept for perspective correction
+
+// Clip codes of the vertices in screen_vertices (see clip.h), sized to the capacity of mesh.positions
+uint16_t* clip_codes = NULL;
+
+// Indices of the faces of the mesh not culled this frame
+int* visible_faces = NULL;
+
+// Faces rejected whole by the clip stage, and faces it had to split, over all frames
+int64_t faces_rejected = 0;
+int64_t faces_clipped = 0;
+
+// Frames the mesh was skipped whole by its bounds, and frames it was wholly inside the frustum and skipped the clip stage
+int64_t meshes_culled = 0;
+int64_t meshes_inside = 0;
+
+// Meshlets culled whole by their normal cone or by their bounding sphere against the frustum, and faces the
+// meshlets left to test one at a time, over all frames
+int64_t meshlets_cone_culled = 0;
+int64_t meshlets_frustum_culled = 0;
+int64_t faces_tested = 0;
+
+// Matrix-vector products done over all frames, and the ones the faces would have done transforming each of
+// their corners and projecting the corners of the faces not culled
+int64_t vertex_transforms = 0;
+int64_t face_corner_transforms = 0;
+
+// Number of threads used to rasterize, including the main thread (0 = one per CPU core)
+int raster_thread_count = 0;
+
+// Accumulated rasterization times for comparing forward shading against the visibility buffer
+typedef struct {
+    double total_ms;
+    int num_frames;
+} pass_timer_t;
+
+pass_timer_t forward_textured_timer = {0, 0};
+pass_timer_t visibility_raster_timer = {0, 0};
+pass_timer_t visibility_shade_timer = {0, 0};
+
+// Where frames are drawn, and where they are shown
+render_target_t render_targets[PRESENT_MAX_BUFFERS];
+render_target_t* render_target = &render_targets[0];
+const presenter_t* presenter = &sdl_presenter;
+
+// Number of render targets: 1 draws and presents each frame on this thread; 2 or 3 draw on a thread of their
+// own while this one presents the finished frames (2 keeps latency low, 3 keeps drawing busy when presenting is slow)
+int present_buffers = 1;
+
+// Keys pressed and quits asked for on this thread while frames are drawn on another, which takes them at the
+// start of its next frame; queued_keys is an array.h array
+SDL_mutex* input_lock = NULL;
+SDL_Keycode* queued_keys = NULL;
+bool quit_queued = false;
+
+// Memory layout of the color, depth and visibility buffers
+enum buffer_layout frame_layout = BUFFER_LAYOUT_LINEAR;
+
+// Format of the depth buffers, and the depth fights counted over all frames when span_count_depth_fights is set
+enum depth_format frame_depth_format = DEPTH_FORMAT_FLOAT32;
+int64_t depth_fights = 0;
+
+// Draw frames below the window size when they take longer than FRAME_TARGET_TIME, and the sum of the
+// scales frames were drawn at for the average printed on exit
+bool dynamic_resolution_enabled = false;
+dynamic_resolution_t dynamic_resolution;
+double frame_scale_total = 0;
+uint64_t frame_start_time = 0;
+
+// Stop after max_frames frames (0 = run until quit), and dump each one to a file named by the printf
+// pattern dump_pattern (given the frame number) unless it is NULL
+int max_frames = 0;
+int num_frames_rendered = 0;
+const char* dump_pattern = NULL;
+enum frame_format dump_format = FRAME_FORMAT_PPM;
+
 bool is_running = false;
 uint32_t previous_frame_time = 0;
 
@@ -42,28 +137,8 @@ bool setup(void) {
     render_method = RENDER_TEXTURED;
     cull_method = CULL_BACKFACE;
 
-    // Allocate the required bytes in memory for the color buffer
-    color_buffer = (uint32_t*) malloc(sizeof(uint32_t) * window_width * window_height);
-    if (!color_buffer) {
-        fprintf(stderr, "Error allocating memory for color_buffer.\n");
-        return false;
-    }
-    // Allocate the required bytes in memory for the z-buffer
-    z_buffer = (float*) malloc(sizeof(float) * window_width * window_height);
-    if (!color_buffer) {
-        fprintf(stderr, "Error allocating memory for z_buffer.\n");
-        return false;
-    }
-    // Creating an SDL texture to display the color buffer
-    color_buffer_texture = SDL_CreateTexture(
-        renderer,
-        SDL_PIXELFORMAT_RGBA32,
-        SDL_TEXTUREACCESS_STREAMING,
-        window_width,
-        window_height
-    );
-    if (!color_buffer_texture) {
-        fprintf(stderr, "Error creating color_buffer texture.\n");
+    // Create the tile bins and the pool of rasterizer threads
+    if (!tiler_init(raster_thread_count > 0 ? raster_thread_count : SDL_GetCPUCount())) {
         return false;
     }
 
@@ -73,6 +148,7 @@ bool setup(void) {
     float znear = 0.1;
     float zfar = 100.0;
     proj_matrix = mat4_make_perspective(fov, aspect, znear, zfar);
+    depth_near = znear;
 
     // Loads the cube mesh data using static cube mesh definiton in mesh.c
     // load_cube_mesh_data();
@@ -89,9 +165,101 @@ bool setup(void) {
     // Load the texture information from an external PNG file
     load_png_texture_data("src\\assets\\drone.png");
 
+    background_t background = {
+        .kind = BACKGROUND_GRID,
+        .color = 0xFF000000,        // black
+        .grid_spacing = 10,
+        .grid_thickness = 1,
+        .grid_color = 0xFFD3D3D3,   // lightgrey
+        .grid_connected = false
+    };
+    if (background_filename) {
+        background_png = upng_new_from_file(background_filename);
+        if (background_png && upng_decode(background_png) == UPNG_EOK && upng_get_format(background_png) == UPNG_RGBA8) {
+            background.kind = BACKGROUND_IMAGE;
+            background.image = (const uint32_t*)upng_get_buffer(background_png);
+            background.image_width = upng_get_width(background_png);
+            background.image_height = upng_get_height(background_png);
+        } else {
+            fprintf(stderr, "Error loading the background image %s, expected an RGBA PNG.\n", background_filename);
+        }
+    }
+    background_set(&background);
+
     return true;
 }
 
+// Restores a tile to the background layer and clears its depth
+void clear_background_tile(rect_t tile) {
+    background_clear_rect(tile);
+    clear_z_buffer_rect(tile);
+}
+
+// Applies the setting bound to a key
+void process_key(SDL_Keycode key) {
+    switch (key) {
+        case SDLK_ESCAPE:
+            is_running = false;
+            break;
+        case SDLK_1:
+            render_method = RENDER_WIRE_VERTEX;
+            break;
+        case SDLK_2:
+            render_method = RENDER_WIRE;
+            break;
+        case SDLK_3:
+            render_method = RENDER_FILL_TRIANGLE;
+            break;
+        case SDLK_4:
+            render_method = RENDER_FILL_TRIANGLE_WIRE;
+            break;
+        case SDLK_5:
+            render_method = RENDER_TEXTURED;
+            break;
+        case SDLK_6:
+            render_method = RENDER_TEXTURED_WIRE;
+            break;
+        case SDLK_7:
+            render_method = RENDER_VISIBILITY;
+            break;
+        case SDLK_8:
+            render_method = RENDER_FILL_TRIANGLE_PAINTER;
+            break;
+        case SDLK_c:
+            cull_method = CULL_BACKFACE;
+            break;
+        case SDLK_d:
+            cull_method = CULL_NONE;
+            break;
+        case SDLK_e:
+            raster_method = RASTER_EDGE_FUNCTION;
+            break;
+        case SDLK_s:
+            raster_method = RASTER_SCANLINE;
+            break;
+        case SDLK_p:
+            // Cycle the affine subdivision of textured spans: exact, every 8 pixels, every 16 pixels
+            span_subdivision = (span_subdivision == 0) ? 8 : (span_subdivision == 8) ? 16 : 0;
+            break;
+        case SDLK_m:
+            span_measure_error = !span_measure_error;
+            break;
+        case SDLK_h:
+            wireframe_depth_test = !wireframe_depth_test;
+            break;
+        case SDLK_w:
+            texture_wrap = (texture_wrap == TEXTURE_WRAP_REPEAT) ? TEXTURE_WRAP_CLAMP : TEXTURE_WRAP_REPEAT;
+            break;
+        case SDLK_l:
+            lazy_clear = !lazy_clear;
+            if (lazy_clear) {
+                // Lazy clears expect the background in every tile that is not drawn into
+                tiler_touch_all();
+            }
+            break;
+    }
+}
+
 void process_input(void) {
     SDL_Event event;
     SDL_PollEvent(&event);
@@ -101,38 +269,41 @@ void process_input(void) {
             is_running = false;
             break;
         case SDL_KEYDOWN: // pressing a key
-            switch (event.key.keysym.sym) {
-                case SDLK_ESCAPE:
-                    is_running = false;
-                    break;
-                case SDLK_1:
-                    render_method = RENDER_WIRE_VERTEX;
-                    break;
-                case SDLK_2:
-                    render_method = RENDER_WIRE;
-                    break;
-                case SDLK_3:
-                    render_method = RENDER_FILL_TRIANGLE;
-                    break;
-                case SDLK_4:
-                    render_method = RENDER_FILL_TRIANGLE_WIRE;
-                    break;
-                case SDLK_5:
-                    render_method = RENDER_TEXTURED;
-                    break;
-                case SDLK_6:
-                    render_method = RENDER_TEXTURED_WIRE;
-                    break;
-                case SDLK_c:
-                    cull_method = CULL_BACKFACE;
-                    break;
-                case SDLK_d:
-                    cull_method = CULL_NONE;
-                    break;
-            }
+            process_key(event.key.keysym.sym);
+            break;
     }
 }
 
+// Input while frames are drawn on a thread of their own: polled on this thread, which owns the window
+void queue_input(void) {
+    SDL_Event event;
+    if (!SDL_PollEvent(&event)) return;
+
+    SDL_LockMutex(input_lock);
+    switch (event.type) {
+        case SDL_QUIT:
+            quit_queued = true;
+            break;
+        case SDL_KEYDOWN:
+            array_push(queued_keys, event.key.keysym.sym);
+            break;
+    }
+    SDL_UnlockMutex(input_lock);
+}
+
+// Handles the input queued by queue_input, on the draw thread
+void take_input(void) {
+    SDL_LockMutex(input_lock);
+    if (quit_queued) {
+        is_running = false;
+    }
+    for (int i = 0; i < array_length(queued_keys); i++) {
+        process_key(queued_keys[i]);
+    }
+    array_reset(queued_keys);
+    SDL_UnlockMutex(input_lock);
+}
+
 void frame_delay(void) {
     int delay_time = FRAME_TARGET_TIME - (SDL_GetTicks() - previous_frame_time);
     if (delay_time > 0) {
@@ -141,8 +312,85 @@ void frame_delay(void) {
     previous_frame_time = SDL_GetTicks();
 }
 
+// Brings the render target about to be drawn to the size dynamic resolution picked
+void resize_render_target(void) {
+    int width = (int)(render_target->max_width * dynamic_resolution.scale + 0.5f);
+    int height = (int)(render_target->max_height * dynamic_resolution.scale + 0.5f);
+    if (width != render_target->width || height != render_target->height) {
+        render_target_resize(render_target, width, height);
+        // What the lazy clears know about the contents of the buffers was for the old size
+        tiler_touch_all();
+    }
+    // The projection below maps to window_width x window_height, so they have to be the new size already
+    render_target_bind(render_target);
+}
+
+// Fills world_vertices and screen_vertices with the vertices of the mesh placed by world_matrix
+bool transform_vertices(mat4_t world_matrix) {
+    if (array_length(clip_codes) < mesh.positions.capacity) {
+        array_reset(clip_codes);
+        clip_codes = array_hold(clip_codes, mesh.positions.capacity, sizeof(uint16_t));
+    }
+    if (!vertex_transform(&mesh.positions, world_matrix, proj_matrix, window_width, window_height, &world_vertices, &screen_vertices, clip_codes)) {
+        return false;
+    }
+    vertex_transforms += 2 * mesh.positions.count;
+    return true;
+}
+
+// Adds a triangle with the given screen space corners to the triangles to render
+void add_triangle_to_render(const vec4_t points[3], const tex2_t texcoords[3], uint32_t color, float avg_depth) {
+    triangle_t* triangle = &triangles_to_render[num_triangles_to_render++];
+    for (int j = 0; j < 3; j++) {
+        triangle->points[j] = points[j];
+        triangle->texcoords[j] = texcoords[j];
+    }
+    triangle->color = color;
+    triangle->avg_depth = avg_depth;
+}
+
+/**
+*    Runs the face through the clip stage and adds the triangles left of it, cut against the planes its
+*    corners are outside of: a fan over the clipped polygon. Corners that survive clipping keep their
+*    position from screen_vertices, so the edges they share with unclipped neighbours stay watertight.
+**/
+void add_clipped_face(const face_t* face, int planes, uint32_t color, float avg_depth) {
+    int indices[3] = {face->a, face->b, face->c};
+    tex2_t uvs[3] = {face->a_uv, face->b_uv, face->c_uv};
+    clip_vertex_t polygon[CLIP_MAX_VERTICES];
+    for (int j = 0; j < 3; j++) {
+        vec4_t world = vertex_stream_get(&world_vertices, indices[j]);
+        polygon[j] = (clip_vertex_t){mat4_mul_vec4(proj_matrix, world), uvs[j], j};
+    }
+    int num_vertices = clip_polygon(polygon, 3, planes, clip_guard_band(window_width), clip_guard_band(window_height));
+
+    vec4_t points[CLIP_MAX_VERTICES];
+    for (int k = 0; k < num_vertices; k++) {
+        int corner = polygon[k].corner;
+        points[k] = (corner >= 0) ? vertex_stream_get(&screen_vertices, indices[corner]) :
+            clip_to_screen(polygon[k].position, window_width, window_height);
+    }
+    for (int k = 1; k + 1 < num_vertices; k++) {
+        vec4_t fan_points[3] = {points[0], points[k], points[k + 1]};
+        tex2_t fan_uvs[3] = {polygon[0].uv, polygon[k].uv, polygon[k + 1].uv};
+        add_triangle_to_render(fan_points, fan_uvs, color, avg_depth);
+    }
+}
+
 void update(void) {
-    frame_delay();
+    if (presenter->frame_limited) {
+        frame_delay();
+    }
+    frame_start_time = SDL_GetPerformanceCounter();
+    if (dynamic_resolution_enabled) {
+        resize_render_target();
+    }
+
+    // Resolve the render settings into the pipeline used for every triangle of this frame
+    pipeline_state_t state = pipeline_state(render_method);
+    state.texture_wrap = texture_wrap;
+    state.wireframe_depth_test = wireframe_depth_test;
+    pipeline_bind(state, mesh_texture);
 
     // Initialize the counter of triangles to render for every frame
     num_triangles_to_render = 0;
@@ -173,219 +421,507 @@ void update(void) {
     world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
     world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
 
-    // Loop through all the triangle faces of our cube mesh
-    int num_faces = array_length(mesh.faces);
-    for (int i = 0; i < num_faces; i++) {
-        face_t mesh_face = mesh.faces[i];
+    // The inverse of the world matrix undoes the same steps in the opposite order, and brings the camera into model space
+    mat4_t inverse_world_matrix = mat4_identity();
+    inverse_world_matrix = mat4_mul_mat4(mat4_make_translation(-mesh.translation.x, -mesh.translation.y, -mesh.translation.z), inverse_world_matrix);
+    inverse_world_matrix = mat4_mul_mat4(mat4_make_rotation_z(-mesh.rotation.z), inverse_world_matrix);
+    inverse_world_matrix = mat4_mul_mat4(mat4_make_rotation_y(-mesh.rotation.y), inverse_world_matrix);
+    inverse_world_matrix = mat4_mul_mat4(mat4_make_rotation_x(-mesh.rotation.x), inverse_world_matrix);
+    inverse_world_matrix = mat4_mul_mat4(mat4_make_scale(1 / mesh.scale.x, 1 / mesh.scale.y, 1 / mesh.scale.z), inverse_world_matrix);
+    vec3_t model_camera = vec3_from_vec4(mat4_mul_vec4(inverse_world_matrix, vec4_from_vec3(camera_position)));
 
-        vec3_t face_vertices[3] = {
-            mesh.vertices[mesh_face.a],
-            mesh.vertices[mesh_face.b],
-            mesh.vertices[mesh_face.c]
-        };
-        
-        vec4_t transformed_vertices[3];
-
-        // Loop all 3 vertices of this current face and apply transformations
-        for (int j = 0; j < 3; j++) {
-            vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
-
-            // Use a matrix to scale, rotate, and translate our original vertex
-            transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
-            
-            //Save transformed vertex in the array of transformed vertices
-            transformed_vertices[j] = transformed_vertex;
+    int num_faces = array_length(mesh.faces);
+    face_corner_transforms += 3 * num_faces; // counted for comparison: transforming the corners of every face
+
+    /* Test the bounds of the whole mesh against the frustum before any of its faces: first the sphere, which is
+    cheap, then for what the sphere leaves open the corners of the box, which fits tighter */
+    vec3_t bounding_center = vec3_from_vec4(mat4_mul_vec4(world_matrix, vec4_from_vec3(mesh.bounding_center)));
+    float max_scale = fmaxf(fabsf(mesh.scale.x), fmaxf(fabsf(mesh.scale.y), fabsf(mesh.scale.z)));
+    vec4_t frustum_planes[6];
+    clip_frustum_planes(proj_matrix, frustum_planes);
+    enum clip_volume_test bounds_test = clip_test_sphere(bounding_center, mesh.bounding_radius * max_scale, frustum_planes);
+    if (bounds_test == CLIP_VOLUME_CROSSING) {
+        mat4_t clip_matrix = mat4_mul_mat4(proj_matrix, world_matrix);
+        vec4_t corners[8];
+        for (int i = 0; i < 8; i++) {
+            vec4_t corner = {
+                (i & 1) ? mesh.bounds_max.x : mesh.bounds_min.x,
+                (i & 2) ? mesh.bounds_max.y : mesh.bounds_min.y,
+                (i & 4) ? mesh.bounds_max.z : mesh.bounds_min.z,
+                1
+            };
+            corners[i] = mat4_mul_vec4(clip_matrix, corner);
         }
-
-        // Calculate triangle face normal
-        vec3_t vector_a = vec3_from_vec4(transformed_vertices[0]); /*   A   */
-        vec3_t vector_b = vec3_from_vec4(transformed_vertices[1]); /*  / \  */ // Triangle is clockwise, hence the order of A, B, and C
-        vec3_t vector_c = vec3_from_vec4(transformed_vertices[2]); /* C---B */
-
-        // Get triangle side vectors with respect to A as the origin
-        vec3_t vector_ab = vec3_sub(vector_b, vector_a);
-        vec3_t vector_ac = vec3_sub(vector_c, vector_a);
-        vec3_normalize(&vector_ab);
-        vec3_normalize(&vector_ac);
-
-        // Compute the face normal (using cross product to find perpendicular)
-        vec3_t normal = vec3_cross(vector_ab, vector_ac); // Note that the order of the cross product matter because our coordinate system is left handed
-        vec3_normalize(&normal);
-
-        // Perform backface culling if enabled
-        if (cull_method == CULL_BACKFACE) {
-            // Compute the camera ray vector (vector pointing from the vertex A directly into the triangle)
-            vec3_t camera_ray = vec3_sub(camera_position, vector_a);
-
-            /* Check how aligned is my normal with my camera ray ->
-            If the dot product between these two vectors is negative, then this face is not visible from the perspective of the camera so should not be rendered */
-            float dot_normal_camera = vec3_dot(normal, camera_ray);
-            if (dot_normal_camera < 0) continue;
+        bounds_test = clip_test_points(corners, 8);
+    }
+    if (bounds_test == CLIP_VOLUME_OUTSIDE) {
+        meshes_culled++;
+        return;
+    }
+    // Inside the frustum no vertex has a clip code, so the faces skip the clip stage
+    bool clip_free = (bounds_test == CLIP_VOLUME_INSIDE);
+    if (clip_free) meshes_inside++;
+
+    // Loop through the meshlets of the mesh, and keep the faces facing the camera
+    array_reset(visible_faces);
+    int num_meshlets = array_length(mesh.meshlets);
+    for (int m = 0; m < num_meshlets; m++) {
+        const meshlet_t* meshlet = &mesh.meshlets[m];
+
+        // Whole meshlets are dropped first: by their normal cone when every face turns away, then by their sphere
+        if (cull_method == CULL_BACKFACE && meshlet_backfacing(meshlet, model_camera)) {
+            meshlets_cone_culled++;
+            continue;
+        }
+        if (!clip_free) {
+            vec3_t center = vec3_from_vec4(mat4_mul_vec4(world_matrix, vec4_from_vec3(meshlet->center)));
+            if (clip_test_sphere(center, meshlet->radius * max_scale, frustum_planes) == CLIP_VOLUME_OUTSIDE) {
+                meshlets_frustum_culled++;
+                continue;
+            }
         }
-      
-        vec4_t projected_points[3];
-
-        // Loop all 3 transformed vertices for this current face and apply projections
-        for (int j = 0; j < 3; j++) {
-            projected_points[j] = mat4_mul_vec4_project(proj_matrix, transformed_vertices[j]);
 
-            // Invert the y-values to account for flipped screen y coordinate
-            projected_points[j].y *= -1;
+        faces_tested += meshlet->num_faces;
+        for (int j = 0; j < meshlet->num_faces; j++) {
+            int face_index = meshlet->first_face + j;
+            const face_t* mesh_face = &mesh.faces[face_index];
+
+            // Perform backface culling if enabled
+            if (cull_method == CULL_BACKFACE) {
+                /* The face is turned away from the camera when the camera is behind its plane: the ray from any point of
+                the face to the camera then points against the normal. Planes and normals are kept in model space, so
+                this costs one dot product and no transformed vertex */
+                float camera_distance = vec3_dot(mesh_face->normal, model_camera) - mesh_face->plane_distance;
+                if (camera_distance < 0) continue;
+            }
+            array_push(visible_faces, face_index);
+        }
+    }
 
-            // Scale into view
-            projected_points[j].x *= (window_width / 2.0);
-            projected_points[j].y *= (window_height / 2.0);
+    // Transform and project every vertex once, however many faces share it
+    if (!transform_vertices(world_matrix)) {
+        is_running = false;
+        return;
+    }
 
-            // Translate the points to the center of the screen
-            projected_points[j].x += (window_width / 2.0);
-            projected_points[j].y += (window_height / 2.0);
+    int num_visible_faces = array_length(visible_faces);
+    int max_triangles = num_visible_faces * CLIP_MAX_TRIANGLES;
+    if (array_length(triangles_to_render) < max_triangles) {
+        array_reset(triangles_to_render);
+        triangles_to_render = array_hold(triangles_to_render, max_triangles, sizeof(triangle_t));
+    }
+    for (int i = 0; i < num_visible_faces; i++) {
+        face_t mesh_face = mesh.faces[visible_faces[i]];
+
+        // Counted for comparison: projecting the corners of every face not culled
+        face_corner_transforms += 3;
+
+        // Faces whose corners are all outside one plane of the clip volume, or one side of the frame, are never seen
+        int planes = 0;
+        if (!clip_free) {
+            uint16_t codes[3] = {clip_codes[mesh_face.a], clip_codes[mesh_face.b], clip_codes[mesh_face.c]};
+            if (codes[0] & codes[1] & codes[2]) {
+                faces_rejected++;
+                continue;
+            }
+            planes = (codes[0] | codes[1] | codes[2]) & CLIP_PLANES;
         }
 
+        vec4_t transformed_vertices[3] = {
+            vertex_stream_get(&world_vertices, mesh_face.a),
+            vertex_stream_get(&world_vertices, mesh_face.b),
+            vertex_stream_get(&world_vertices, mesh_face.c)
+        };
+
         /* Use light source and face normal to caluclate intensity of triangle color by checking
         how aligned my light source is with face normal by taking their dot product.*/
-        float light_intensity_factor = -vec3_dot(normal, light_source.direction);
-        uint32_t triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
+        uint32_t triangle_color = mesh_face.color;
+        if (pipeline.state.lighting) {
+            vec3_t normal = mat4_mul_normal(inverse_world_matrix, mesh_face.normal);
+            vec3_normalize(&normal);
+            float light_intensity_factor = -vec3_dot(normal, light_source.direction);
+            triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
+        }
 
         /* Calculate average of the z/depth of all three vertices in the face to be used by painter's algorithm
         after the triangles are updated to sort the order the faces will be rendered in (to avoid faces in back showing in front of faces in the front) */
         float avg_depth = (transformed_vertices[0].z + transformed_vertices[1].z + transformed_vertices[2].z) / 3.0;
 
-        triangle_t projected_triangle = {
-            .points = {
-                {projected_points[0].x, projected_points[0].y, projected_points[0].z, projected_points[0].w},
-                {projected_points[1].x, projected_points[1].y, projected_points[1].z, projected_points[1].w},
-                {projected_points[2].x, projected_points[2].y, projected_points[2].z, projected_points[2].w}
-            },
-            .texcoords = {
-                {mesh_face.a_uv.u, mesh_face.a_uv.v},
-                {mesh_face.b_uv.u, mesh_face.b_uv.v},
-                {mesh_face.c_uv.u, mesh_face.c_uv.v}
-            },
-            .color = triangle_color,
-            .avg_depth = avg_depth
+        // Faces crossing the near or far plane, or leaving the guard band, go through the clip stage
+        if (planes) {
+            faces_clipped++;
+            add_clipped_face(&mesh_face, planes, triangle_color, avg_depth);
+            continue;
+        }
+
+        vec4_t projected_points[3] = {
+            vertex_stream_get(&screen_vertices, mesh_face.a),
+            vertex_stream_get(&screen_vertices, mesh_face.b),
+            vertex_stream_get(&screen_vertices, mesh_face.c)
         };
+        tex2_t texcoords[3] = {mesh_face.a_uv, mesh_face.b_uv, mesh_face.c_uv};
 
         // Save the projected triangle in the array of triangles to render
-        if (num_triangles_to_render < MAX_TRIANGLES_PER_MESH) {
-            triangles_to_render[num_triangles_to_render++] = projected_triangle;
-        }
+        add_triangle_to_render(projected_points, texcoords, triangle_color, avg_depth);
     }
 
-    // // Painter's algorithm:
-    // // Sort the triangles to render by their average depth using bubble sort
-    // // TODO:: Convert this sorting into merge_sort for better runtime complexity
-    // int num_triangles = array_length(triangles_to_render);
-    // for (int i = 0; i < num_triangles; i++) {
-    //     for (int j = i; j < num_triangles; j++) {
-    //         if (triangles_to_render[i].avg_depth < triangles_to_render[j].avg_depth) {
-    //             triangle_t temp = triangles_to_render[i];
-    //             triangles_to_render[i] = triangles_to_render[j];
-    //             triangles_to_render[j] = temp;
-    //         }
-    //     }
-    // }
+    /* Sort the triangles to render by their average depth: back to front for the painter's algorithm,
+    front to back otherwise so that nearer triangles fill the z-buffer first and hide the ones behind them early */
+    enum sort_order order = pipeline.state.depth_test ? SORT_FRONT_TO_BACK : SORT_BACK_TO_FRONT;
+    sort_triangles_by_depth(triangles_to_render, num_triangles_to_render, order);
 }
 
-void render(void) {
-    draw_grid(10, 1, 0xFFD3D3D3, false); // lightgrey grid
-
-    for (int i = 0; i < num_triangles_to_render; i++) {
-            triangle_t triangle = triangles_to_render[i];
-
-            // Draw vertex points as rectangles with width point_scale if enabled
-            if (render_method == RENDER_WIRE_VERTEX) {
-                int point_scale = 4;
-                draw_rectangle(
-                    triangle.points[0].x - point_scale/2,
-                    triangle.points[0].y - point_scale/2,
-                    point_scale,
-                    point_scale,
-                    0xFFFF0000 // red projected points
-                );
-                draw_rectangle(
-                    triangle.points[1].x - point_scale/2,
-                    triangle.points[1].y - point_scale/2,
-                    point_scale,
-                    point_scale,
-                    0xFFFF0000 // red projected points
-                );
-                draw_rectangle(
-                    triangle.points[2].x - point_scale/2,
-                    triangle.points[2].y - point_scale/2,
-                    point_scale,
-                    point_scale,
-                    0xFFFF0000 // red projected points
-                );
-            }
+// Draws triangle number index of triangles_to_render through the passes of the bound pipeline, only inside clip
+void draw_triangle(int index, rect_t clip) {
+    const triangle_t* triangle = &triangles_to_render[index];
+    for (int i = 0; i < pipeline.num_passes; i++) {
+        pipeline.passes[i](triangle, index, clip);
+    }
+}
 
-            // Draw filled triangles if enabled
-            if (render_method == RENDER_FILL_TRIANGLE || render_method == RENDER_FILL_TRIANGLE_WIRE) {
-                draw_filled_triangle(
-                    triangle.points[0].x, triangle.points[0].y, triangle.points[0].w,
-                    triangle.points[1].x, triangle.points[1].y, triangle.points[1].w,
-                    triangle.points[2].x, triangle.points[2].y, triangle.points[2].w,
-                    triangle.color
-                );
-            }
+// Milliseconds elapsed since the given SDL performance counter value
+double elapsed_ms(uint64_t start) {
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
 
-            // Draw textured triangles if enabled
-            if (render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE) {
-                draw_textured_triangle(
-                    triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, triangle.texcoords[0].u, triangle.texcoords[0].v, // vertex A
-                    triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w, triangle.texcoords[1].u, triangle.texcoords[1].v, // vertex B
-                    triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w, triangle.texcoords[2].u, triangle.texcoords[2].v, // vertex C
-                    mesh_texture
-                );
-            }
+void pass_timer_add(pass_timer_t* timer, double ms) {
+    timer->total_ms += ms;
+    timer->num_frames++;
+}
 
-            // Draw wireframe = unfilled triangles if enabled
-            if (render_method != RENDER_FILL_TRIANGLE && render_method != RENDER_TEXTURED) {
-                draw_unfilled_triangle(
-                    triangle.points[0].x,
-                    triangle.points[0].y,
-                    triangle.points[1].x,
-                    triangle.points[1].y,
-                    triangle.points[2].x,
-                    triangle.points[2].y,
-                    0xFFFFFFFF // white lines for the wireframe
-                );
-            }
+void pass_timer_print(const char* name, pass_timer_t timer) {
+    if (timer.num_frames > 0) {
+        printf("\n%s: %.3f ms/frame over %d frames", name, timer.total_ms / timer.num_frames, timer.num_frames);
     }
+}
+
+// Writes the finished frame to a file if frame dumps were asked for
+bool dump_frame(void) {
+    if (!dump_pattern) return true;
+
+    char filename[1024];
+    snprintf(filename, sizeof(filename), dump_pattern, num_frames_rendered);
+    return render_target_dump(render_target, filename, dump_format);
+}
 
-    if (!render_color_buffer()) {
+// Restores the background of the frame about to be drawn
+void clear_frame(void) {
+    if (lazy_clear) {
+        // Memory lent by the presenter holds nothing of the last frame, and with several render targets the
+        // one drawn into holds an older frame, so every tile needs its background back
+        if (render_target->color_borrowed || present_buffers > 1) {
+            tiler_touch_all();
+        }
+        background_prepare();
+        tiler_clear_touched(clear_background_tile);
+        return;
+    }
+    background_clear();
+    // Frames that neither test nor write depth leave the z-buffer alone
+    if (pipeline.state.depth_test || pipeline.state.depth_write) {
+        clear_z_buffer();
+    }
+}
+
+void render(void) {
+    if (!presenter->begin(render_target)) {
         is_running = false;
         return;
     }
+    render_target_bind(render_target);
+    clear_frame();
+
+    uint64_t raster_start = SDL_GetPerformanceCounter();
+    if (pipeline.serial) {
+        // The scanline rasterizer cannot be restricted to a tile, so it always draws serially
+        for (int i = 0; i < num_triangles_to_render; i++) {
+            draw_triangle(i, screen_rect());
+        }
+        tiler_touch_all();
+    } else {
+        tiler_draw(triangles_to_render, num_triangles_to_render, draw_triangle);
+    }
+
+    if (render_method == RENDER_TEXTURED) {
+        pass_timer_add(&forward_textured_timer, elapsed_ms(raster_start));
+    }
+    if (render_method == RENDER_VISIBILITY) {
+        pass_timer_add(&visibility_raster_timer, elapsed_ms(raster_start));
+
+        // Shade every visible pixel exactly once from the triangle stored in the visibility buffer
+        uint64_t shade_start = SDL_GetPerformanceCounter();
+        visibility_prepare(triangles_to_render, num_triangles_to_render, mesh_texture, pipeline.state.texture_wrap);
+        tiler_run(visibility_shade_tile);
+        pass_timer_add(&visibility_shade_timer, elapsed_ms(shade_start));
+    }
+    if (span_count_depth_fights) {
+        depth_fights += span_take_depth_fights();
+    }
 
-    clear_color_buffer(0xFF000000); // black background
-    clear_z_buffer();
+    // With lazy clears only the boxes drawn this frame or the last one differ from the presented frame
+    if (lazy_clear) {
+        tiler_take_changed(&render_target->changed);
+    } else {
+        render_target_set_changed(render_target, screen_rect());
+    }
 
-    SDL_RenderPresent(renderer);
+    // Dump before presenting, which may hand the color buffer back to the presenter
+    if (!dump_frame()) {
+        is_running = false;
+    } else if (present_buffers > 1) {
+        render_target = present_thread_submit(render_target);
+        if (!render_target) {
+            is_running = false;
+        }
+    } else if (!presenter->present(render_target)) {
+        is_running = false;
+    }
+}
+
+// Draws the next frame and hands it on to be presented
+void draw_frame(void) {
+    update();
+    render();
+    if (dynamic_resolution_enabled) {
+        frame_scale_total += dynamic_resolution.scale;
+        dynamic_resolution_update(&dynamic_resolution, elapsed_ms(frame_start_time));
+    }
+    num_frames_rendered += 1;
+    if (max_frames > 0 && num_frames_rendered >= max_frames) {
+        is_running = false;
+    }
+}
+
+// Body of the draw thread when the main thread presents
+int draw_frames(void* data) {
+    while (is_running) {
+        if (presenter->has_input) {
+            take_input();
+        }
+        draw_frame();
+    }
+    return 0;
 }
 
 // Free the memory that was dynamically allocated by the program
 void free_resources(void) {
-    free(color_buffer);
-    free(z_buffer);
+    tiler_destroy();
+    for (int i = 0; i < present_buffers; i++) {
+        render_target_destroy(&render_targets[i]);
+    }
+    visibility_free();
+    sort_free();
+    background_free();
     array_free(mesh.vertices);
     array_free(mesh.faces);
+    array_free(mesh.meshlets);
+    vertex_stream_free(&mesh.positions);
+    vertex_stream_free(&world_vertices);
+    vertex_stream_free(&screen_vertices);
+    array_free(visible_faces);
+    array_free(clip_codes);
+    array_free(triangles_to_render);
+    array_free(queued_keys);
+    if (input_lock) {
+        SDL_DestroyMutex(input_lock);
+    }
     upng_free(png_texture);
+    if (background_png) {
+        upng_free(background_png);
+    }
+}
+
+// Parses a frame size given as WIDTHxHEIGHT
+bool parse_size(const char* text, int* width, int* height) {
+    return sscanf(text, "%dx%d", width, height) == 2 && *width > 0 && *height > 0;
+}
+
+// Parses a depth format given by its name
+bool parse_depth_format(const char* text, enum depth_format* format) {
+    if (strcmp(text, "float32") == 0) {
+        *format = DEPTH_FORMAT_FLOAT32;
+    } else if (strcmp(text, "unorm24") == 0) {
+        *format = DEPTH_FORMAT_UNORM24;
+    } else if (strcmp(text, "unorm16") == 0) {
+        *format = DEPTH_FORMAT_UNORM16;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parses a buffer layout given by its name
+bool parse_layout(const char* text, enum buffer_layout* layout) {
+    if (strcmp(text, "linear") == 0) {
+        *layout = BUFFER_LAYOUT_LINEAR;
+    } else if (strcmp(text, "tiled") == 0) {
+        *layout = BUFFER_LAYOUT_TILED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parses a frame dump format given by its name
+bool parse_dump_format(const char* text, enum frame_format* format) {
+    if (strcmp(text, "ppm") == 0) {
+        *format = FRAME_FORMAT_PPM;
+    } else if (strcmp(text, "raw") == 0) {
+        *format = FRAME_FORMAT_RAW;
+    } else {
+        return false;
+    }
+    return true;
 }
 
 int main(int argc, char* args[]) {
-    is_running = initialize_window();
-    is_running = setup();
+    int width = 0;
+    int height = 0;
+    const char* start_keys = "";
+
+    // Command line options:
+    //   --threads N       number of rasterizer threads
+    //   --subdivide N     affine subdivision of textured spans
+    //   --headless        render without a window or SDL video, as fast as possible
+    //   --copy-present    copy every frame into the window texture instead of drawing straight into it
+    //   --present-buffers N  1 (default) draws and presents on the main thread; 2 or 3 draw on a thread of their own
+    //   --background F    draw frames over the RGBA PNG image F instead of the grid
+    //   --layout L        linear (default) or tiled color and depth buffers
+    //   --depth-format F  float32 (default), unorm24 or unorm16 depth buffers
+    //   --dynamic-resolution  lower the resolution frames are drawn at while they miss FRAME_TARGET_TIME
+    //   --depth-fights    count the pixels that fail the depth test by comparing equal to the stored depth
+    //   --size WxH        frame size (default: fullscreen, or 800x600 when headless)
+    //   --frames N        stop after N frames (default: when the window is closed, or 1 frame when headless)
+    //   --dump PATTERN    write every frame to a file named by a printf pattern, e.g. frame_%04d.ppm
+    //   --dump-format F   ppm (default) or raw RGBA bytes
+    //   --keys KEYS       press the given keys once at start, e.g. --keys 4h for a depth tested wireframe
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(args[i], "--threads") == 0 && i + 1 < argc) {
+            raster_thread_count = atoi(args[++i]);
+        } else if (strcmp(args[i], "--subdivide") == 0 && i + 1 < argc) {
+            span_subdivision = atoi(args[++i]);
+        } else if (strcmp(args[i], "--headless") == 0) {
+            presenter = &headless_presenter;
+        } else if (strcmp(args[i], "--copy-present") == 0) {
+            zero_copy_present = false;
+        } else if (strcmp(args[i], "--present-buffers") == 0 && i + 1 < argc) {
+            present_buffers = atoi(args[++i]);
+            if (present_buffers < 1 || present_buffers > PRESENT_MAX_BUFFERS) {
+                fprintf(stderr, "Invalid number of present buffers %s, expected 1 to %d.\n", args[i], PRESENT_MAX_BUFFERS);
+                return 1;
+            }
+        } else if (strcmp(args[i], "--background") == 0 && i + 1 < argc) {
+            background_filename = args[++i];
+        } else if (strcmp(args[i], "--layout") == 0 && i + 1 < argc) {
+            if (!parse_layout(args[++i], &frame_layout)) {
+                fprintf(stderr, "Invalid buffer layout %s, expected linear or tiled.\n", args[i]);
+                return 1;
+            }
+        } else if (strcmp(args[i], "--depth-format") == 0 && i + 1 < argc) {
+            if (!parse_depth_format(args[++i], &frame_depth_format)) {
+                fprintf(stderr, "Invalid depth format %s, expected float32, unorm24 or unorm16.\n", args[i]);
+                return 1;
+            }
+        } else if (strcmp(args[i], "--dynamic-resolution") == 0) {
+            dynamic_resolution_enabled = true;
+        } else if (strcmp(args[i], "--depth-fights") == 0) {
+            span_count_depth_fights = true;
+        } else if (strcmp(args[i], "--size") == 0 && i + 1 < argc) {
+            if (!parse_size(args[++i], &width, &height)) {
+                fprintf(stderr, "Invalid frame size %s, expected WIDTHxHEIGHT.\n", args[i]);
+                return 1;
+            }
+        } else if (strcmp(args[i], "--frames") == 0 && i + 1 < argc) {
+            max_frames = atoi(args[++i]);
+        } else if (strcmp(args[i], "--dump") == 0 && i + 1 < argc) {
+            dump_pattern = args[++i];
+        } else if (strcmp(args[i], "--dump-format") == 0 && i + 1 < argc) {
+            if (!parse_dump_format(args[++i], &dump_format)) {
+                fprintf(stderr, "Invalid dump format %s, expected ppm or raw.\n", args[i]);
+                return 1;
+            }
+        } else if (strcmp(args[i], "--keys") == 0 && i + 1 < argc) {
+            start_keys = args[++i];
+        }
+    }
+    if (!presenter->has_input && max_frames <= 0) {
+        max_frames = 1;
+    }
 
-    int num_frames_rendered = 0;
-    while (is_running) {
-        process_input();
-        update();
-        render();
-        num_frames_rendered += 1;
+    // Every render target but one is still being presented while the next frame is drawn, so none of them
+    // can be the presenter's own memory; neither can tiled buffers, which are only detiled when presenting
+    if (present_buffers > 1 || frame_layout == BUFFER_LAYOUT_TILED) {
+        zero_copy_present = false;
+    }
+
+    int pitch = 0;
+    is_running = presenter->open(&width, &height, &pitch);
+    for (int i = 0; is_running && i < present_buffers; i++) {
+        is_running = render_target_create(&render_targets[i], width, height, pitch, frame_layout, frame_depth_format);
+    }
+    if (is_running) {
+        render_target_bind(render_target);
+        dynamic_resolution_init(&dynamic_resolution, FRAME_TARGET_TIME);
+        is_running = setup();
+    }
+    for (const char* key = start_keys; is_running && *key; key++) {
+        process_key((SDL_Keycode)*key);
+    }
+
+    uint64_t start_time = SDL_GetPerformanceCounter();
+    if (is_running && present_buffers > 1) {
+        // Returns once every frame drawn has been presented, so the clock only stops after they were all shown
+        input_lock = SDL_CreateMutex();
+        if (!input_lock) {
+            fprintf(stderr, "Error creating the input lock.\n");
+        } else if (!present_thread_run(presenter, render_targets, present_buffers, draw_frames,
+                presenter->has_input ? queue_input : NULL)) {
+            fprintf(stderr, "Error presenting frames.\n");
+        }
+    } else {
+        while (is_running) {
+            if (presenter->has_input) {
+                process_input();
+            }
+            draw_frame();
+        }
+    }
+    printf("Actual FPS: %.2f", num_frames_rendered / (elapsed_ms(start_time) / 1000.0));
+    pass_timer_print("Forward textured raster", forward_textured_timer);
+    pass_timer_print("Visibility buffer raster", visibility_raster_timer);
+    pass_timer_print("Visibility buffer shade", visibility_shade_timer);
+    if (span_max_error() > 0) {
+        printf("\nMax affine subdivision error: %.3f texels", span_max_error());
+    }
+    if (presenter == &sdl_presenter && num_frames_rendered > 0) {
+        printf("\nUploaded to the window texture: %.1f KB/frame", uploaded_bytes / 1024.0 / num_frames_rendered);
+    }
+    if (dynamic_resolution_enabled && num_frames_rendered > 0) {
+        printf("\nDynamic resolution: %.2f average scale, %.2f at exit", frame_scale_total / num_frames_rendered, dynamic_resolution.scale);
+    }
+    if (num_frames_rendered > 0) {
+        printf("\nVertex transforms: %.0f/frame, %.0f transforming every face corner", (double)vertex_transforms / num_frames_rendered,
+            (double)face_corner_transforms / num_frames_rendered);
+    }
+    if (num_frames_rendered > 0) {
+        printf("\nClip stage: %.1f faces rejected and %.1f clipped per frame", (double)faces_rejected / num_frames_rendered,
+            (double)faces_clipped / num_frames_rendered);
+    }
+    if (num_frames_rendered > 0) {
+        printf("\nMesh bounds: %.2f meshes culled and %.2f drawn without clipping per frame", (double)meshes_culled / num_frames_rendered,
+            (double)meshes_inside / num_frames_rendered);
+    }
+    if (num_frames_rendered > 0 && array_length(mesh.meshlets) > 0) {
+        printf("\nMeshlets: %d of %.1f faces on average, %.1f culled by normal cone and %.1f by frustum per frame, %.0f of %d faces tested",
+            array_length(mesh.meshlets), (double)array_length(mesh.faces) / array_length(mesh.meshlets),
+            (double)meshlets_cone_culled / num_frames_rendered, (double)meshlets_frustum_culled / num_frames_rendered,
+            (double)faces_tested / num_frames_rendered, array_length(mesh.faces));
+    }
+    if (span_count_depth_fights && num_frames_rendered > 0) {
+        printf("\nDepth fights: %.1f pixels/frame over %d frames", (double)depth_fights / num_frames_rendered, num_frames_rendered);
     }
-    printf("Actual FPS: %.2f", num_frames_rendered / (SDL_GetTicks() / 1000.0));
 
-    destroy_window();
+    presenter->close();
     free_resources();
 
     return 0;
@@ -100,4 +100,13 @@ mat4_t mat4_mul_mat4(mat4_t a, mat4_t b) {
         }
     }
     return m;
-}
\ No newline at end of file
+}
+
+vec3_t mat4_mul_normal(mat4_t inverse, vec3_t normal) {
+    // Normals go by the transpose of the inverse, which keeps them perpendicular to the surface under any scale
+    vec3_t result;
+    result.x = inverse.m[0][0] * normal.x + inverse.m[1][0] * normal.y + inverse.m[2][0] * normal.z;
+    result.y = inverse.m[0][1] * normal.x + inverse.m[1][1] * normal.y + inverse.m[2][1] * normal.z;
+    result.z = inverse.m[0][2] * normal.x + inverse.m[1][2] * normal.y + inverse.m[2][2] * normal.z;
+    return result;
+}
@@ -18,4 +18,7 @@ vec4_t mat4_mul_vec4(mat4_t m, vec4_t v);
 vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v);
 mat4_t mat4_mul_mat4(mat4_t a, mat4_t b);
 
+// Brings a normal into the space a matrix maps to, given the inverse of that matrix
+vec3_t mat4_mul_normal(mat4_t inverse, vec3_t normal);
+
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <math.h>
 #include <string.h>
 #include "array.h"
 #include "mesh.h"
@@ -6,6 +7,8 @@
 mesh_t mesh = {
     .vertices = NULL,
     .faces = NULL,
+    .positions = {0},
+    .meshlets = NULL,
     .rotation = { 0, 0, 0 },
     .scale = { 1.0, 1.0, 1.0 },
     .translation = { 0, 0, 0 }
@@ -43,6 +46,68 @@ face_t cube_faces[N_CUBE_FACES] = {
     { .a = 6, .b = 1, .c = 4, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 }, .color = 0xFFFFFFFF }
 };
 
+// Box and sphere around the vertices; the sphere is centered on the box, which keeps it within a few percent of the smallest one for most models
+static void compute_bounds(void) {
+    int num_vertices = array_length(mesh.vertices);
+    if (num_vertices == 0) {
+        mesh.bounds_min = mesh.bounds_max = mesh.bounding_center = (vec3_t){0, 0, 0};
+        mesh.bounding_radius = 0;
+        return;
+    }
+    mesh.bounds_min = mesh.bounds_max = mesh.vertices[0];
+    for (int i = 1; i < num_vertices; i++) {
+        vec3_t v = mesh.vertices[i];
+        if (v.x < mesh.bounds_min.x) mesh.bounds_min.x = v.x;
+        if (v.y < mesh.bounds_min.y) mesh.bounds_min.y = v.y;
+        if (v.z < mesh.bounds_min.z) mesh.bounds_min.z = v.z;
+        if (v.x > mesh.bounds_max.x) mesh.bounds_max.x = v.x;
+        if (v.y > mesh.bounds_max.y) mesh.bounds_max.y = v.y;
+        if (v.z > mesh.bounds_max.z) mesh.bounds_max.z = v.z;
+    }
+    mesh.bounding_center = vec3_mul(vec3_add(mesh.bounds_min, mesh.bounds_max), 0.5);
+    float radius_squared = 0;
+    for (int i = 0; i < num_vertices; i++) {
+        vec3_t offset = vec3_sub(mesh.vertices[i], mesh.bounding_center);
+        float distance_squared = vec3_dot(offset, offset);
+        if (distance_squared > radius_squared) radius_squared = distance_squared;
+    }
+    mesh.bounding_radius = sqrtf(radius_squared);
+}
+
+/**
+*    Prepares what does not change from frame to frame once a mesh is loaded: the position stream the
+*    vertex transform reads, the box and sphere the mesh is culled by, the plane of every face, which
+*    back-face culling tests the camera against in model space, and the meshlets the faces are culled by.
+**/
+static void finish_loading(void) {
+    vertex_stream_from_vec3(&mesh.positions, mesh.vertices, array_length(mesh.vertices), 3);
+    compute_bounds();
+
+    int num_faces = array_length(mesh.faces);
+    for (int i = 0; i < num_faces; i++) {
+        face_t* face = &mesh.faces[i];
+        vec3_t vector_a = mesh.vertices[face->a]; /*   A   */
+        vec3_t vector_b = mesh.vertices[face->b]; /*  / \  */ // Triangle is clockwise, hence the order of A, B, and C
+        vec3_t vector_c = mesh.vertices[face->c]; /* C---B */
+
+        // The order of the cross product matters because our coordinate system is left handed
+        face->normal = vec3_cross(vec3_sub(vector_b, vector_a), vec3_sub(vector_c, vector_a));
+        vec3_normalize(&face->normal);
+        face->plane_distance = vec3_dot(face->normal, vector_a);
+    }
+
+    if (!meshlets_build(mesh.vertices, array_length(mesh.vertices), mesh.faces, num_faces, &mesh.meshlets) && num_faces > 0) {
+        // Still draw every face: one meshlet for the whole mesh, with a cone that never culls
+        fprintf(stderr, "Error building meshlets, culling the mesh as a single one.\n");
+        meshlet_t whole = {
+            .first_face = 0, .num_faces = num_faces, .center = mesh.bounding_center, .radius = mesh.bounding_radius,
+            .cone_axis = {0, 0, 0}, .cone_cos = 0, .cone_sin = 1
+        };
+        array_reset(mesh.meshlets);
+        array_push(mesh.meshlets, whole);
+    }
+}
+
 void load_cube_mesh_data(void) {
     for (int i = 0; i < N_CUBE_VERTICES; i++) {
         vec3_t cube_vertex = cube_vertices[i];
@@ -52,6 +117,7 @@ void load_cube_mesh_data(void) {
         face_t cube_face = cube_faces[i];
         array_push(mesh.faces, cube_face);
     }
+    finish_loading();
 }
 
 void load_obj_file_data(char* filename) {
@@ -98,4 +164,5 @@ void load_obj_file_data(char* filename) {
         }
     }
     array_free(texcoords);
+    finish_loading();
 }
\ No newline at end of file
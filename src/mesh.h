@@ -3,6 +3,8 @@
 
 #include "vector.h"
 #include "triangle.h"
+#include "vertex.h"
+#include "meshlet.h"
 
 #define N_CUBE_VERTICES 8
 #define N_CUBE_FACES (6 * 2) // 6 cube faces, 2 triangles per face
@@ -13,7 +15,13 @@ extern face_t mesh_faces[N_CUBE_FACES];
 // Define a struct for dynamic size meshes
 typedef struct {
     vec3_t* vertices;   // dynamic array of vertices for this mesh
-    face_t* faces;      // dynamic array of faces
+    vertex_stream_t positions; // the vertices as separate x, y and z arrays, which the vertex transform reads
+    face_t* faces;      // dynamic array of faces, in the order of their meshlets
+    meshlet_t* meshlets; // dynamic array of the clusters the faces are culled by
+    vec3_t bounds_min;  // corners of the axis aligned box around the vertices, in model space
+    vec3_t bounds_max;
+    vec3_t bounding_center; // sphere around the vertices, in model space
+    float bounding_radius;
     vec3_t rotation;    // rotation with x, y, and z values
     vec3_t scale;       // scale with x, y, and z values
     vec3_t translation; // translation with x, y, and z values
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+#include "meshlet.h"
+
+// Box center and enclosing radius of the corners of the faces of meshlet
+static void meshlet_bound_sphere(meshlet_t* meshlet, const vec3_t* vertices, const face_t* faces) {
+    const face_t* first = &faces[meshlet->first_face];
+    vec3_t min = vertices[first->a];
+    vec3_t max = min;
+    for (int i = 0; i < meshlet->num_faces; i++) {
+        const face_t* face = &faces[meshlet->first_face + i];
+        int corners[3] = {face->a, face->b, face->c};
+        for (int j = 0; j < 3; j++) {
+            vec3_t v = vertices[corners[j]];
+            min.x = fminf(min.x, v.x); min.y = fminf(min.y, v.y); min.z = fminf(min.z, v.z);
+            max.x = fmaxf(max.x, v.x); max.y = fmaxf(max.y, v.y); max.z = fmaxf(max.z, v.z);
+        }
+    }
+    meshlet->center = vec3_mul(vec3_add(min, max), 0.5);
+
+    float radius_squared = 0;
+    for (int i = 0; i < meshlet->num_faces; i++) {
+        const face_t* face = &faces[meshlet->first_face + i];
+        int corners[3] = {face->a, face->b, face->c};
+        for (int j = 0; j < 3; j++) {
+            vec3_t offset = vec3_sub(vertices[corners[j]], meshlet->center);
+            radius_squared = fmaxf(radius_squared, vec3_dot(offset, offset));
+        }
+    }
+    meshlet->radius = sqrtf(radius_squared);
+}
+
+// Axis along the average normal of the faces of meshlet, and the widest angle of any of them to it
+static void meshlet_bound_cone(meshlet_t* meshlet, const face_t* faces) {
+    vec3_t normal_sum = {0, 0, 0};
+    for (int i = 0; i < meshlet->num_faces; i++) {
+        vec3_t normal = faces[meshlet->first_face + i].normal;
+        if (vec3_dot(normal, normal) > 0) normal_sum = vec3_add(normal_sum, normal);
+    }
+    meshlet->cone_axis = normal_sum;
+    meshlet->cone_cos = 0;
+    meshlet->cone_sin = 1;
+    float length = vec3_length(normal_sum);
+    if (!(length > 0)) return;
+    meshlet->cone_axis = vec3_div(normal_sum, length);
+
+    float least_cos = 1;
+    for (int i = 0; i < meshlet->num_faces; i++) {
+        float normal_cos = vec3_dot(faces[meshlet->first_face + i].normal, meshlet->cone_axis);
+        // Degenerate faces have no normal, and the per-face test never culls them, so neither may the cone
+        if (!(normal_cos >= least_cos)) least_cos = isnan(normal_cos) ? -1 : normal_cos;
+    }
+    if (least_cos <= 0) return;
+    meshlet->cone_cos = least_cos;
+    meshlet->cone_sin = sqrtf(fmaxf(0, 1 - least_cos * least_cos));
+}
+
+// The faces of each cell of the grid are binned by the axis direction their normal is nearest to
+#define GRID_NORMAL_BINS 6
+
+/**
+*    Uniform grid over the centroids of the faces, for finding free faces near a point without looking at
+*    every face. The faces of bin b of cell c are cell_faces[cell_start[i]] up to cell_faces[cell_end[i]],
+*    where i is c * GRID_NORMAL_BINS + b; faces taken by a meshlet are dropped from their bin when a search
+*    comes across them.
+**/
+typedef struct {
+    int size; // cells along each axis
+    vec3_t min;
+    vec3_t cells_per_unit;
+    float bin_cos; // least cosine of a normal to an axis that may be within MESHLET_MIN_NORMAL_COS of a face in its bin
+    int* cell_start;
+    int* cell_end;
+    int* cell_faces;
+} face_grid_t;
+
+static int grid_coordinate(float value, float min, float cells_per_unit, int size) {
+    int c = (int) ((value - min) * cells_per_unit);
+    return (c < 0) ? 0 : (c >= size) ? size - 1 : c;
+}
+
+static int grid_cell(const face_grid_t* grid, vec3_t p) {
+    int x = grid_coordinate(p.x, grid->min.x, grid->cells_per_unit.x, grid->size);
+    int y = grid_coordinate(p.y, grid->min.y, grid->cells_per_unit.y, grid->size);
+    int z = grid_coordinate(p.z, grid->min.z, grid->cells_per_unit.z, grid->size);
+    return (z * grid->size + y) * grid->size + x;
+}
+
+// Bin of the axis direction nearest to normal: +x, -x, +y, -y, +z, -z
+static int normal_bin(vec3_t normal) {
+    float ax = fabsf(normal.x), ay = fabsf(normal.y), az = fabsf(normal.z);
+    if (ax >= ay && ax >= az) return (normal.x < 0) ? 1 : 0;
+    if (ay >= az) return (normal.y < 0) ? 3 : 2;
+    return (normal.z < 0) ? 5 : 4;
+}
+
+// Cosine of normal to the axis direction of bin
+static float normal_bin_cos(vec3_t normal, int bin) {
+    float component = (bin < 2) ? normal.x : (bin < 4) ? normal.y : normal.z;
+    return (bin % 2) ? -component : component;
+}
+
+static float cells_per_unit(float extent, int size) {
+    return (extent > 0) ? size / extent : 0;
+}
+
+static bool grid_build(face_grid_t* grid, const vec3_t* centroids, const face_t* faces, int num_faces) {
+    // About MESHLET_GRID_CELL_FACES faces per cell where the faces spread evenly
+    grid->size = (int) ceilf(cbrtf((float) num_faces / MESHLET_GRID_CELL_FACES));
+    if (grid->size > MESHLET_GRID_MAX_SIZE) grid->size = MESHLET_GRID_MAX_SIZE;
+    vec3_t min = centroids[0];
+    vec3_t max = centroids[0];
+    for (int i = 1; i < num_faces; i++) {
+        min.x = fminf(min.x, centroids[i].x); min.y = fminf(min.y, centroids[i].y); min.z = fminf(min.z, centroids[i].z);
+        max.x = fmaxf(max.x, centroids[i].x); max.y = fmaxf(max.y, centroids[i].y); max.z = fmaxf(max.z, centroids[i].z);
+    }
+    grid->min = min;
+    grid->cells_per_unit = (vec3_t){
+        cells_per_unit(max.x - min.x, grid->size), cells_per_unit(max.y - min.y, grid->size), cells_per_unit(max.z - min.z, grid->size)
+    };
+    // A unit normal is at most acos(1 / sqrt(3)) from the axis of its bin
+    grid->bin_cos = cosf(acosf(MESHLET_MIN_NORMAL_COS) + acosf(1 / sqrtf(3)));
+
+    int num_bins = grid->size * grid->size * grid->size * GRID_NORMAL_BINS;
+    grid->cell_start = calloc(num_bins + 1, sizeof(int));
+    grid->cell_end = malloc(num_bins * sizeof(int));
+    grid->cell_faces = malloc(num_faces * sizeof(int));
+    if (!grid->cell_start || !grid->cell_end || !grid->cell_faces) return false;
+
+    // Counted, then filled in order of the faces, which keeps every bin sorted by face index
+    for (int i = 0; i < num_faces; i++) {
+        grid->cell_start[grid_cell(grid, centroids[i]) * GRID_NORMAL_BINS + normal_bin(faces[i].normal) + 1]++;
+    }
+    for (int b = 0; b < num_bins; b++) {
+        grid->cell_start[b + 1] += grid->cell_start[b];
+        grid->cell_end[b] = grid->cell_start[b];
+    }
+    for (int i = 0; i < num_faces; i++) {
+        int b = grid_cell(grid, centroids[i]) * GRID_NORMAL_BINS + normal_bin(faces[i].normal);
+        grid->cell_faces[grid->cell_end[b]++] = i;
+    }
+    return true;
+}
+
+static void grid_free(face_grid_t* grid) {
+    free(grid->cell_start);
+    free(grid->cell_end);
+    free(grid->cell_faces);
+}
+
+/**
+*    Checks the free faces in the bins of cell c set in the bits of bins for one nearer to center than
+*    nearest, turned within MESHLET_MIN_NORMAL_COS of normal.
+**/
+static void grid_search_cell(face_grid_t* grid, int c, int bins, const vec3_t* centroids, const face_t* faces,
+    const int* queued_by, int id, vec3_t center, vec3_t normal, int* nearest, float* nearest_distance) {
+    for (int b = c * GRID_NORMAL_BINS; bins; b++, bins >>= 1) {
+        if (!(bins & 1)) continue;
+        for (int k = grid->cell_start[b]; k < grid->cell_end[b]; k++) {
+            int i = grid->cell_faces[k];
+            if (queued_by[i] < 0) {
+                // Taken for good: move the last face of the bin into its place
+                grid->cell_faces[k--] = grid->cell_faces[--grid->cell_end[b]];
+                continue;
+            }
+            if (queued_by[i] == id) continue;
+            if (vec3_dot(faces[i].normal, normal) < MESHLET_MIN_NORMAL_COS) continue;
+            vec3_t offset = vec3_sub(centroids[i], center);
+            float distance = vec3_dot(offset, offset);
+            if (distance < *nearest_distance || (distance == *nearest_distance && i < *nearest)) {
+                *nearest = i;
+                *nearest_distance = distance;
+            }
+        }
+    }
+}
+
+// Least distance from center, in cell c along an axis, to the cells more than ring away from c on that axis; INFINITY if none
+static float grid_ring_distance(float center, float min, float cells_per_unit, int size, int c, int ring) {
+    float distance = INFINITY;
+    if (cells_per_unit <= 0) return distance;
+    if (c - ring > 0) distance = center - (min + (c - ring) / cells_per_unit);
+    if (c + ring < size - 1) distance = fminf(distance, min + (c + ring + 1) / cells_per_unit - center);
+    return fmaxf(distance, 0);
+}
+
+/**
+*    Nearest free face to center turned within MESHLET_MIN_NORMAL_COS of normal, searched in rings of cells
+*    around the cell of center, at most MESHLET_GRID_SEARCH_RINGS of them; -1 if there is none that near.
+*    Faces queued by meshlet id are not free. Equally near faces go to the lowest index, so the result does
+*    not depend on the order the cells were searched in.
+**/
+static int grid_nearest_free(face_grid_t* grid, const vec3_t* centroids, const face_t* faces, const int* queued_by, int id,
+    vec3_t center, vec3_t normal) {
+    int cx = grid_coordinate(center.x, grid->min.x, grid->cells_per_unit.x, grid->size);
+    int cy = grid_coordinate(center.y, grid->min.y, grid->cells_per_unit.y, grid->size);
+    int cz = grid_coordinate(center.z, grid->min.z, grid->cells_per_unit.z, grid->size);
+    int bins = 0;
+    for (int b = 0; b < GRID_NORMAL_BINS; b++) {
+        if (normal_bin_cos(normal, b) >= grid->bin_cos) bins |= 1 << b;
+    }
+    int nearest = -1;
+    float nearest_distance = INFINITY;
+    if (!bins) return nearest;
+    for (int ring = 0; ring <= MESHLET_GRID_SEARCH_RINGS; ring++) {
+        for (int z = cz - ring; z <= cz + ring; z++) {
+            for (int y = cy - ring; y <= cy + ring; y++) {
+                for (int x = cx - ring; x <= cx + ring; x++) {
+                    if (x < 0 || y < 0 || z < 0 || x >= grid->size || y >= grid->size || z >= grid->size) continue;
+                    // Only the cells on the outside of the ring, the ones inside were searched before
+                    if (abs(x - cx) != ring && abs(y - cy) != ring && abs(z - cz) != ring) continue;
+                    grid_search_cell(grid, (z * grid->size + y) * grid->size + x, bins, centroids, faces, queued_by, id,
+                        center, normal, &nearest, &nearest_distance);
+                }
+            }
+        }
+        // Done once the cells left are all farther than the nearest face found, or there are none left
+        float ring_distance = fminf(grid_ring_distance(center.x, grid->min.x, grid->cells_per_unit.x, grid->size, cx, ring),
+            fminf(grid_ring_distance(center.y, grid->min.y, grid->cells_per_unit.y, grid->size, cy, ring),
+                grid_ring_distance(center.z, grid->min.z, grid->cells_per_unit.z, grid->size, cz, ring)));
+        if (ring_distance == INFINITY || nearest_distance <= ring_distance * ring_distance) break;
+    }
+    return nearest;
+}
+
+bool meshlets_build(const vec3_t* vertices, int num_vertices, face_t* faces, int num_faces, meshlet_t** meshlets) {
+    array_reset(*meshlets);
+    if (num_faces == 0) return true;
+
+    // The faces around each vertex: vertex_faces[vertex_start[v]] up to vertex_faces[vertex_start[v + 1]]
+    int* vertex_start = calloc(num_vertices + 1, sizeof(int));
+    int* vertex_faces = malloc(3 * num_faces * sizeof(int));
+    int* queue = malloc(num_faces * sizeof(int));
+    int* queued_by = malloc(num_faces * sizeof(int)); // meshlet that last queued each face, -1 once in one
+    vec3_t* centroids = malloc(num_faces * sizeof(vec3_t));
+    int* order = malloc(num_faces * sizeof(int)); // the faces of each meshlet in turn
+    face_t* ordered_faces = malloc(num_faces * sizeof(face_t));
+    face_grid_t grid = {0};
+    if (!vertex_start || !vertex_faces || !queue || !queued_by || !centroids || !order || !ordered_faces) {
+        fprintf(stderr, "Error allocating memory for the meshlets of %d faces.\n", num_faces);
+        free(vertex_start);
+        free(vertex_faces);
+        free(queue);
+        free(queued_by);
+        free(centroids);
+        free(order);
+        free(ordered_faces);
+        return false;
+    }
+    for (int i = 0; i < num_faces; i++) {
+        vertex_start[faces[i].a + 1]++;
+        vertex_start[faces[i].b + 1]++;
+        vertex_start[faces[i].c + 1]++;
+        queued_by[i] = num_faces;
+        centroids[i] = vec3_div(vec3_add(vec3_add(vertices[faces[i].a], vertices[faces[i].b]), vertices[faces[i].c]), 3);
+    }
+    for (int v = 0; v < num_vertices; v++) {
+        vertex_start[v + 1] += vertex_start[v];
+    }
+    // Filling a range moves its start up to the start of the next, so the starts are moved back one after
+    for (int i = 0; i < num_faces; i++) {
+        vertex_faces[vertex_start[faces[i].a]++] = i;
+        vertex_faces[vertex_start[faces[i].b]++] = i;
+        vertex_faces[vertex_start[faces[i].c]++] = i;
+    }
+    for (int v = num_vertices; v > 0; v--) {
+        vertex_start[v] = vertex_start[v - 1];
+    }
+    vertex_start[0] = 0;
+
+    if (!grid_build(&grid, centroids, faces, num_faces)) {
+        fprintf(stderr, "Error allocating memory for the meshlets of %d faces.\n", num_faces);
+        grid_free(&grid);
+        free(vertex_start);
+        free(vertex_faces);
+        free(queue);
+        free(queued_by);
+        free(centroids);
+        free(order);
+        free(ordered_faces);
+        return false;
+    }
+
+    int num_ordered = 0;
+    for (int seed = 0; seed < num_faces; seed++) {
+        if (queued_by[seed] < 0) continue;
+
+        int id = array_length(*meshlets);
+        meshlet_t meshlet = {.first_face = num_ordered, .num_faces = 0};
+        vec3_t normal_sum = {0, 0, 0};
+        vec3_t average_normal = {0, 0, 0};
+        vec3_t centroid_sum = {0, 0, 0};
+        int queue_length = 0;
+        bool searching = true; // until the grid has no free face near enough, which it will not have later either
+        queue[queue_length++] = seed;
+        queued_by[seed] = id;
+        for (int head = 0; head < queue_length && meshlet.num_faces < MESHLET_MAX_FACES; head++) {
+            if (head == queue_length - 1 && meshlet.num_faces > 0 && searching) {
+                /* The last neighbour: models are often made of many small separate parts, so rather than end the
+                meshlet, queue also the nearest free face around it turned the same way */
+                vec3_t center = vec3_div(centroid_sum, meshlet.num_faces);
+                int nearest = grid_nearest_free(&grid, centroids, faces, queued_by, id, center, average_normal);
+                if (nearest >= 0) {
+                    queued_by[nearest] = id;
+                    queue[queue_length++] = nearest;
+                } else {
+                    searching = false;
+                }
+            }
+            int f = queue[head];
+            const face_t* face = &faces[f];
+
+            // Faces turned too far from the rest are left for a later meshlet, where they keep its cone narrow
+            if (meshlet.num_faces > 0 && vec3_dot(face->normal, average_normal) < MESHLET_MIN_NORMAL_COS) continue;
+
+            queued_by[f] = -1;
+            order[num_ordered++] = f;
+            meshlet.num_faces++;
+            centroid_sum = vec3_add(centroid_sum, centroids[f]);
+            if (vec3_dot(face->normal, face->normal) > 0) {
+                normal_sum = vec3_add(normal_sum, face->normal);
+                float length = vec3_length(normal_sum);
+                if (length > 0) average_normal = vec3_div(normal_sum, length);
+            }
+
+            int corners[3] = {face->a, face->b, face->c};
+            for (int j = 0; j < 3; j++) {
+                for (int k = vertex_start[corners[j]]; k < vertex_start[corners[j] + 1]; k++) {
+                    int neighbour = vertex_faces[k];
+                    if (queued_by[neighbour] < 0 || queued_by[neighbour] == id) continue;
+                    queued_by[neighbour] = id;
+                    queue[queue_length++] = neighbour;
+                }
+            }
+        }
+        array_push(*meshlets, meshlet);
+    }
+
+    for (int i = 0; i < num_faces; i++) {
+        ordered_faces[i] = faces[order[i]];
+    }
+    memcpy(faces, ordered_faces, num_faces * sizeof(face_t));
+    int num_meshlets = array_length(*meshlets);
+    for (int m = 0; m < num_meshlets; m++) {
+        meshlet_bound_sphere(&(*meshlets)[m], vertices, faces);
+        meshlet_bound_cone(&(*meshlets)[m], faces);
+    }
+
+    grid_free(&grid);
+    free(vertex_start);
+    free(vertex_faces);
+    free(queue);
+    free(queued_by);
+    free(centroids);
+    free(order);
+    free(ordered_faces);
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <stdbool.h>
+#include <math.h>
+#include "vector.h"
+#include "triangle.h"
+
+// Most faces in a meshlet
+#define MESHLET_MAX_FACES 128
+
+/**
+*    Faces join a meshlet only while their normal stays within about 25 degrees of its average normal.
+*    Narrower cones cull from more directions, but make smaller meshlets, each with a test of its own.
+**/
+#define MESHLET_MIN_NORMAL_COS 0.9f
+
+/**
+*    Meshlets that run out of neighbours go on with the nearest free face in the cells of a grid around
+*    them, up to MESHLET_GRID_SEARCH_RINGS cells away; the grid has about MESHLET_GRID_CELL_FACES faces per
+*    cell, and at most MESHLET_GRID_MAX_SIZE cells along each axis. This bounds the search for each meshlet
+*    by the faces around it instead of all the faces of the mesh.
+**/
+#define MESHLET_GRID_CELL_FACES 32
+#define MESHLET_GRID_MAX_SIZE 32
+#define MESHLET_GRID_SEARCH_RINGS 4
+
+/**
+*    A cluster of neighbouring faces of a mesh, in model space, that is culled as a whole before any of its
+*    faces: by a bounding sphere against the frustum, and by a normal cone when all of its faces turn away
+*    from the camera. The normal of every face is within the angle of cone_cos and cone_sin of cone_axis;
+*    cone_cos is 0 or less when the normals spread too far for the cone to ever cull.
+**/
+typedef struct {
+    int first_face; // index of its first face in the faces of the mesh
+    int num_faces;
+    vec3_t center;
+    float radius;
+    vec3_t cone_axis;
+    float cone_cos;
+    float cone_sin;
+} meshlet_t;
+
+/**
+*    Splits the faces of a mesh into meshlets, by growing each from its lowest numbered face still free to
+*    its neighbours through shared vertices, breadth first, and on to the nearest free face around it when
+*    they run out. The faces are reordered so that each meshlet is a range of them. Nothing but the faces and
+*    vertices decides, so the same mesh always gives the same meshlets. meshlets is an array.h array,
+*    which is replaced.
+**/
+bool meshlets_build(const vec3_t* vertices, int num_vertices, face_t* faces, int num_faces, meshlet_t** meshlets);
+
+/**
+*    Tells whether every face of meshlet turns away from camera, in model space: seen from anywhere its
+*    sphere reaches, the normals in the cone all point away from the camera.
+**/
+static inline bool meshlet_backfacing(const meshlet_t* meshlet, vec3_t camera) {
+    if (meshlet->cone_cos <= 0) return false;
+    vec3_t view = vec3_sub(meshlet->center, camera);
+    float distance = vec3_length(view);
+    if (distance <= meshlet->radius) return false;
+
+    // The angle between view and any normal is at most the angle of view to the axis plus the cone's
+    float view_cos = vec3_dot(view, meshlet->cone_axis) / distance;
+    float view_sin = sqrtf(fmaxf(0, 1 - view_cos * view_cos));
+    float least_cos = view_cos * meshlet->cone_cos - view_sin * meshlet->cone_sin;
+    return distance * least_cos > meshlet->radius;
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include "pipeline.h"
+
+pipeline_t pipeline;
+
+// Vertex points as red rectangles of width point_scale
+static void pass_vertices(const triangle_t* triangle, int index, rect_t clip) {
+    int point_scale = 4;
+    for (int j = 0; j < 3; j++) {
+        draw_rectangle_clipped(
+            triangle->points[j].x - point_scale/2,
+            triangle->points[j].y - point_scale/2,
+            point_scale,
+            point_scale,
+            0xFFFF0000, // red projected points
+            clip
+        );
+    }
+}
+
+static void pass_wireframe(const triangle_t* triangle, int index, rect_t clip) {
+    draw_unfilled_triangle_clipped(
+        triangle->points[0].x,
+        triangle->points[0].y,
+        triangle->points[1].x,
+        triangle->points[1].y,
+        triangle->points[2].x,
+        triangle->points[2].y,
+        0xFFFFFFFF, // white lines for the wireframe
+        clip
+    );
+}
+
+static void pass_wireframe_depth_tested(const triangle_t* triangle, int index, rect_t clip) {
+    const vec4_t* p = triangle->points;
+    draw_line_depth_clipped(p[0].x, p[0].y, p[0].w, p[1].x, p[1].y, p[1].w, 0xFFFFFFFF, clip);
+    draw_line_depth_clipped(p[1].x, p[1].y, p[1].w, p[2].x, p[2].y, p[2].w, 0xFFFFFFFF, clip);
+    draw_line_depth_clipped(p[2].x, p[2].y, p[2].w, p[0].x, p[0].y, p[0].w, 0xFFFFFFFF, clip);
+}
+
+static void pass_filled(const triangle_t* triangle, int index, rect_t clip) {
+    draw_filled_triangle_clipped(triangle, clip);
+}
+
+static void pass_filled_scanline(const triangle_t* triangle, int index, rect_t clip) {
+    draw_filled_triangle(
+        triangle->points[0].x, triangle->points[0].y, triangle->points[0].w,
+        triangle->points[1].x, triangle->points[1].y, triangle->points[1].w,
+        triangle->points[2].x, triangle->points[2].y, triangle->points[2].w,
+        triangle->color
+    );
+}
+
+static void pass_textured(const triangle_t* triangle, int index, rect_t clip) {
+    draw_textured_triangle_clipped(triangle, pipeline.texture, clip);
+}
+
+static void pass_textured_scanline(const triangle_t* triangle, int index, rect_t clip) {
+    draw_textured_triangle(
+        triangle->points[0].x, triangle->points[0].y, triangle->points[0].z, triangle->points[0].w, triangle->texcoords[0].u, triangle->texcoords[0].v, // vertex A
+        triangle->points[1].x, triangle->points[1].y, triangle->points[1].z, triangle->points[1].w, triangle->texcoords[1].u, triangle->texcoords[1].v, // vertex B
+        triangle->points[2].x, triangle->points[2].y, triangle->points[2].z, triangle->points[2].w, triangle->texcoords[2].u, triangle->texcoords[2].v, // vertex C
+        pipeline.texture
+    );
+}
+
+static void pass_visibility(const triangle_t* triangle, int index, rect_t clip) {
+    draw_visibility_triangle_clipped(triangle, index, clip);
+}
+
+pipeline_state_t pipeline_state(enum render_method render_method) {
+    pipeline_state_t state;
+    state.render_method = render_method;
+    state.depth_test = (render_method != RENDER_FILL_TRIANGLE_PAINTER);
+    state.depth_write = state.depth_test;
+    state.texture_wrap = TEXTURE_WRAP_REPEAT;
+    state.wireframe_depth_test = false;
+    state.lighting = (
+        render_method == RENDER_FILL_TRIANGLE ||
+        render_method == RENDER_FILL_TRIANGLE_WIRE ||
+        render_method == RENDER_FILL_TRIANGLE_PAINTER
+    );
+    return state;
+}
+
+static void pipeline_add_pass(triangle_pass_fn pass) {
+    pipeline.passes[pipeline.num_passes++] = pass;
+}
+
+void pipeline_bind(pipeline_state_t state, uint32_t* texture) {
+    pipeline.state = state;
+    pipeline.texture = texture;
+    pipeline.filled_span = span_select_filled(depth_format, state.depth_test, state.depth_write);
+    pipeline.textured_span = span_select_textured(depth_format, state.depth_test, state.depth_write, state.texture_wrap);
+
+    // The visibility buffer and the painter's algorithm only exist for the edge function rasterizer
+    bool scanline = (raster_method == RASTER_SCANLINE);
+    pipeline.serial = false;
+    pipeline.num_passes = 0;
+    switch (state.render_method) {
+        case RENDER_WIRE_VERTEX:
+            pipeline_add_pass(pass_vertices);
+            pipeline_add_pass(pass_wireframe);
+            break;
+        case RENDER_WIRE:
+            pipeline_add_pass(pass_wireframe);
+            break;
+        case RENDER_FILL_TRIANGLE:
+        case RENDER_FILL_TRIANGLE_WIRE:
+            pipeline_add_pass(scanline ? pass_filled_scanline : pass_filled);
+            pipeline.serial = scanline;
+            break;
+        case RENDER_TEXTURED:
+        case RENDER_TEXTURED_WIRE:
+            pipeline_add_pass(scanline ? pass_textured_scanline : pass_textured);
+            pipeline.serial = scanline;
+            break;
+        case RENDER_VISIBILITY:
+            pipeline_add_pass(pass_visibility);
+            break;
+        case RENDER_FILL_TRIANGLE_PAINTER:
+            pipeline_add_pass(pass_filled);
+            break;
+    }
+    // Only the wireframes drawn over filled triangles have a z-buffer to be tested against
+    if (state.render_method == RENDER_FILL_TRIANGLE_WIRE || state.render_method == RENDER_TEXTURED_WIRE) {
+        pipeline_add_pass(state.wireframe_depth_test ? pass_wireframe_depth_tested : pass_wireframe);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "display.h"
+#include "triangle.h"
+#include "span.h"
+
+enum render_method {
+    RENDER_WIRE,
+    RENDER_WIRE_VERTEX,
+    RENDER_FILL_TRIANGLE,
+    RENDER_FILL_TRIANGLE_WIRE,
+    RENDER_TEXTURED,
+    RENDER_TEXTURED_WIRE,
+    RENDER_VISIBILITY, // textured, with deferred texturing through the visibility buffer
+    RENDER_FILL_TRIANGLE_PAINTER // flat shaded, sorted back to front and drawn without a z-buffer
+};
+
+// Everything that decides how triangles are drawn, fixed for a whole frame
+typedef struct {
+    enum render_method render_method;
+    bool depth_test;
+    bool depth_write;
+    enum texture_wrap texture_wrap;
+    bool lighting; // shade the flat triangle colors by the light source
+    bool wireframe_depth_test; // hide the wireframe edges that are behind filled triangles
+} pipeline_state_t;
+
+// Draws one stage of a triangle (vertices, fill, texture, wireframe...), only inside clip
+typedef void (*triangle_pass_fn)(const triangle_t* triangle, int index, rect_t clip);
+
+#define PIPELINE_MAX_PASSES 3
+
+/**
+*    A pipeline state resolved into the work to do per triangle: the list of passes for the render method
+*    and the span kernels specialized for the depth and texture state. Nothing in there is decided again
+*    per triangle or per pixel.
+**/
+typedef struct {
+    pipeline_state_t state;
+    triangle_pass_fn passes[PIPELINE_MAX_PASSES];
+    int num_passes;
+    filled_span_fn filled_span;
+    textured_span_fn textured_span;
+    uint32_t* texture;
+    bool serial; // the passes use the scanline rasterizer, which cannot be restricted to a tile
+} pipeline_t;
+
+// The pipeline bound for the current frame
+extern pipeline_t pipeline;
+
+// Default state of a render method: depth tested unless it uses the painter's algorithm, lit if flat shaded
+pipeline_state_t pipeline_state(enum render_method render_method);
+
+// Selects the passes and kernels for state, drawing textured triangles with texture
+void pipeline_bind(pipeline_state_t state, uint32_t* texture);
+
+#endif
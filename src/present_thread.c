@@ -0,0 +1,78 @@
+#include <SDL2/SDL.h>
+#include "present_thread.h"
+
+static render_target_t* targets = NULL;
+static int num_targets = 0;
+static int (*draw_function)(void* data) = NULL;
+
+static SDL_sem* frames_queued = NULL; // finished frames waiting to be presented, plus one post when drawing ends
+static SDL_sem* targets_free = NULL;  // presented render targets the draw thread may draw into again
+static SDL_atomic_t frames_submitted;
+static SDL_atomic_t present_failed;
+
+// Draws until draw_function returns, then wakes the present thread once more, with no frame, to stop it
+static int draw_thread_run(void* data) {
+    int result = draw_function(data);
+    SDL_SemPost(frames_queued);
+    return result;
+}
+
+render_target_t* present_thread_submit(render_target_t* target) {
+    // The semaphores order the pixel writes of the draw thread before the reads of the present thread, and back
+    SDL_AtomicAdd(&frames_submitted, 1);
+    SDL_SemPost(frames_queued);
+    SDL_SemWait(targets_free);
+    if (SDL_AtomicGet(&present_failed)) return NULL;
+    return &targets[(target - targets + 1) % num_targets];
+}
+
+bool present_thread_run(const presenter_t* presenter, render_target_t* render_targets, int count,
+    int (*draw)(void* data), void (*poll_input)(void)) {
+    targets = render_targets;
+    num_targets = count;
+    draw_function = draw;
+    SDL_AtomicSet(&frames_submitted, 0);
+    SDL_AtomicSet(&present_failed, 0);
+
+    // The draw thread starts out with the first target, the others are free
+    frames_queued = SDL_CreateSemaphore(0);
+    targets_free = SDL_CreateSemaphore(num_targets - 1);
+    SDL_Thread* draw_thread = NULL;
+    if (!frames_queued || !targets_free) {
+        fprintf(stderr, "Error creating the present thread semaphores.\n");
+        SDL_AtomicSet(&present_failed, 1);
+    } else if (!(draw_thread = SDL_CreateThread(draw_thread_run, "draw", NULL))) {
+        fprintf(stderr, "Error creating the draw thread: %s\n", SDL_GetError());
+        SDL_AtomicSet(&present_failed, 1);
+    }
+
+    // Frames are presented in the order they were drawn, which is the order of the targets array
+    int frames_presented = 0;
+    while (draw_thread) {
+        if (poll_input) {
+            poll_input();
+            if (SDL_SemWaitTimeout(frames_queued, PRESENT_INPUT_POLL_MS) != 0) continue;
+        } else {
+            SDL_SemWait(frames_queued);
+        }
+        // Every frame is submitted before drawing ends, so a wake with all of them presented is the last
+        if (frames_presented == SDL_AtomicGet(&frames_submitted)) break;
+
+        // After a failure the frames are only handed back, so the draw thread sees it and stops
+        if (!SDL_AtomicGet(&present_failed) && !presenter->present(&targets[frames_presented % num_targets])) {
+            SDL_AtomicSet(&present_failed, 1);
+        }
+        frames_presented++;
+        SDL_SemPost(targets_free);
+    }
+    if (draw_thread) {
+        SDL_WaitThread(draw_thread, NULL);
+    }
+
+    SDL_sem** semaphores[] = {&frames_queued, &targets_free};
+    for (int i = 0; i < 2; i++) {
+        if (*semaphores[i]) SDL_DestroySemaphore(*semaphores[i]);
+        *semaphores[i] = NULL;
+    }
+    return !SDL_AtomicGet(&present_failed);
+}
@@ -0,0 +1,34 @@
+#ifndef PRESENT_THREAD_H
+#define PRESENT_THREAD_H
+
+#include <stdbool.h>
+#include "presenter.h"
+#include "render_target.h"
+
+// Most render targets (color/depth buffer pairs) cycled between drawing and presenting
+#define PRESENT_MAX_BUFFERS 3
+
+// Longest wait for a finished frame before the present thread polls input again, in milliseconds
+#define PRESENT_INPUT_POLL_MS 5
+
+/**
+*    Overlaps presenting frame k with drawing frame k + 1. The frames are drawn into num_targets render
+*    targets in turn: with 2 presenting is at most one frame behind (double buffering, lowest latency); with
+*    3 drawing can run a frame further ahead when presenting is slow (triple buffering, best throughput).
+*    SDL renderers only work on the thread that created them, so that thread stays the present thread and
+*    drawing moves instead: present_thread_run starts draw on a thread of its own, then uploads and presents
+*    every frame it submits straight from its render target, in order, until draw returns. poll_input, if
+*    not NULL, is called on the present thread whenever it waits for a frame.
+*    Returns false if the draw thread could not be started or a present failed.
+**/
+bool present_thread_run(const presenter_t* presenter, render_target_t* targets, int num_targets,
+    int (*draw)(void* data), void (*poll_input)(void));
+
+/**
+*    Called by draw for every finished frame: queues target for presenting and returns the render target to
+*    draw the next frame into, once the frame last drawn into it is presented. Returns NULL once a present
+*    has failed, after which draw should return.
+**/
+render_target_t* present_thread_submit(render_target_t* target);
+
+#endif
@@ -0,0 +1,36 @@
+#include "presenter.h"
+
+static bool headless_open(int* width, int* height, int* pitch) {
+    // Only the timer is needed, for frame timing
+    if (SDL_Init(SDL_INIT_TIMER) != 0) {
+        fprintf(stderr, "Error initializing SDL.\n");
+        return false;
+    }
+    if (*width <= 0 || *height <= 0) {
+        *width = HEADLESS_DEFAULT_WIDTH;
+        *height = HEADLESS_DEFAULT_HEIGHT;
+    }
+    *pitch = *width;
+    return true;
+}
+
+static bool headless_begin(render_target_t* target) {
+    return true;
+}
+
+static bool headless_present(const render_target_t* target) {
+    return true;
+}
+
+static void headless_close(void) {
+    SDL_Quit();
+}
+
+const presenter_t headless_presenter = {
+    headless_open,
+    headless_begin,
+    headless_present,
+    headless_close,
+    false,
+    false
+};
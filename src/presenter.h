@@ -0,0 +1,34 @@
+#ifndef PRESENTER_H
+#define PRESENTER_H
+
+#include <stdbool.h>
+#include "render_target.h"
+
+// Frame size of the headless presenter when none is given
+#define HEADLESS_DEFAULT_WIDTH 800
+#define HEADLESS_DEFAULT_HEIGHT 600
+
+/**
+*    Shows finished frames of a render target somewhere. The renderer itself only ever draws into the
+*    render target, so it runs the same with a window (sdl_presenter) or with no display at all.
+**/
+typedef struct {
+    // Opens the presenter for frames of width x height; a size of 0 lets the presenter pick (and return) it.
+    // pitch returns the row pitch (in pixels, at least width) to create the render target with
+    bool (*open)(int* width, int* height, int* pitch);
+    // Called before drawing each frame; may point the target's color buffer at memory the presenter shows directly
+    bool (*begin)(render_target_t* target);
+    // Shows the frame in target; only ever called on the thread that opened the presenter
+    bool (*present)(const render_target_t* target);
+    void (*close)(void);
+    bool has_input;     // keyboard and window events come through SDL_PollEvent
+    bool frame_limited; // frames are paced to FPS
+} presenter_t;
+
+// Borderless SDL window, fullscreen sized by default
+extern const presenter_t sdl_presenter;
+
+// No window and no SDL video at all: frames are only kept in the render target (and dumped, if asked to)
+extern const presenter_t headless_presenter;
+
+#endif
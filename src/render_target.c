@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include "array.h"
+#include "render_target.h"
+
+// Rows stored for frames of height rows: only whole micro-tiles are stored in the tiled layout
+static int stored_rows(enum buffer_layout layout, int height) {
+    if (layout == BUFFER_LAYOUT_TILED) {
+        return ((height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE) * HIZ_BLOCK_SIZE;
+    }
+    return height;
+}
+
+bool render_target_create(render_target_t* target, int width, int height, int pitch, enum buffer_layout layout, enum depth_format format) {
+    target->max_width = width;
+    target->max_height = height;
+    target->pitch = (pitch > width) ? pitch : width;
+    target->layout = layout;
+    target->depth_format = format;
+    if (layout == BUFFER_LAYOUT_TILED) {
+        target->pitch = ((target->pitch + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE) * HIZ_BLOCK_SIZE;
+    }
+    int hiz_width = (width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+    int hiz_height = (height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+
+    // Allocate the required bytes in memory for the color buffer, z-buffer and visibility buffer
+    int num_pixels = target->pitch * stored_rows(layout, height);
+    target->color_storage = (uint32_t*) malloc(sizeof(uint32_t) * num_pixels);
+    target->z_buffer = malloc((size_t)depth_format_size(format) * num_pixels);
+    target->visibility_buffer = (uint32_t*) malloc(sizeof(uint32_t) * num_pixels);
+    // and the hierarchical z-buffer with one entry per block of the z-buffer
+    target->hiz_buffer = (float*) malloc(sizeof(float) * hiz_width * hiz_height);
+    target->color_buffer = target->color_storage;
+    target->color_borrowed = false;
+    target->changed = NULL;
+    if (!target->color_buffer || !target->z_buffer || !target->visibility_buffer || !target->hiz_buffer) {
+        fprintf(stderr, "Error allocating memory for a %dx%d render target.\n", width, height);
+        render_target_destroy(target);
+        return false;
+    }
+
+    // No triangle is visible anywhere until the deferred texturing mode writes the visibility buffer
+    for (int i = 0; i < num_pixels; i++) {
+        target->visibility_buffer[i] = VISIBILITY_NONE;
+    }
+    render_target_resize(target, width, height);
+    return true;
+}
+
+void render_target_resize(render_target_t* target, int width, int height) {
+    target->width = (width < 1) ? 1 : (width > target->max_width) ? target->max_width : width;
+    target->height = (height < 1) ? 1 : (height > target->max_height) ? target->max_height : height;
+    // The frame only spans the first rows, so whole buffer clears stop there
+    target->length = target->pitch * stored_rows(target->layout, target->height);
+    target->hiz_width = (target->width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+    target->hiz_height = (target->height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+    render_target_set_changed(target, (rect_t) {0, 0, target->width - 1, target->height - 1});
+}
+
+void render_target_set_changed(render_target_t* target, rect_t rect) {
+    array_reset(target->changed);
+    if (rect.min_x <= rect.max_x && rect.min_y <= rect.max_y) {
+        array_push(target->changed, rect);
+    }
+}
+
+void render_target_destroy(render_target_t* target) {
+    free(target->color_storage);
+    free(target->z_buffer);
+    free(target->visibility_buffer);
+    free(target->hiz_buffer);
+    array_free(target->changed);
+    target->color_storage = NULL;
+    target->color_buffer = NULL;
+    target->z_buffer = NULL;
+    target->visibility_buffer = NULL;
+    target->hiz_buffer = NULL;
+    target->changed = NULL;
+}
+
+void render_target_bind(const render_target_t* target) {
+    window_width = target->width;
+    window_height = target->height;
+    window_pitch = target->pitch;
+    buffer_length = target->length;
+    buffer_layout = target->layout;
+    color_buffer = target->color_buffer;
+    z_buffer = target->z_buffer;
+    depth_format = target->depth_format;
+    visibility_buffer = target->visibility_buffer;
+    hiz_buffer = target->hiz_buffer;
+    hiz_width = target->hiz_width;
+    hiz_height = target->hiz_height;
+}
+
+bool render_target_dump(const render_target_t* target, const char* filename, enum frame_format format) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        fprintf(stderr, "Error opening %s to dump a frame.\n", filename);
+        return false;
+    }
+    if (format == FRAME_FORMAT_PPM) {
+        fprintf(file, "P6\n%d %d\n255\n", target->width, target->height);
+    }
+
+    // Pixels are RGBA32: red in the lowest byte of every color_buffer value, alpha in the highest
+    int channels = (format == FRAME_FORMAT_PPM) ? 3 : 4;
+    unsigned char* row = (unsigned char*) malloc(target->width * channels);
+    bool success = (row != NULL);
+    for (int y = 0; success && y < target->height; y++) {
+        for (int x = 0; x < target->width; x++) {
+            uint32_t color = target->color_buffer[buffer_index(target->layout, target->pitch, x, y)];
+            for (int c = 0; c < channels; c++) {
+                row[(x * channels) + c] = (color >> (8 * c)) & 0xFF;
+            }
+        }
+        success = (fwrite(row, channels, target->width, file) == (size_t)target->width);
+    }
+    free(row);
+    if (fclose(file) != 0) success = false;
+    if (!success) {
+        fprintf(stderr, "Error writing the frame dump %s.\n", filename);
+    }
+    return success;
+}
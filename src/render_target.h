@@ -0,0 +1,60 @@
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "display.h"
+
+/**
+*    Offscreen surface the renderer draws into, with an explicit size and no dependency on SDL video.
+*    Owns every per-pixel buffer: color (SDL_PIXELFORMAT_RGBA32 pixels, as the SDL window shows them),
+*    depth, the visibility buffer and the hierarchical z-buffer.
+*    Rows of the per-pixel buffers are pitch pixels apart, which lets a presenter lend its own (padded)
+*    memory as the color buffer for a frame: color_buffer then points there instead of at color_storage.
+*    The buffers are stored in layout; tiled buffers are padded to whole micro-tiles. z_buffer holds
+*    depth_format values.
+*    The buffers are allocated for max_width x max_height pixels, and the frame drawn into them can be
+*    resized to anything up to that without reallocating: rows keep their pitch, so a smaller frame is the
+*    top left corner of the buffers.
+**/
+struct render_target_t {
+    int width;
+    int height;
+    int max_width;
+    int max_height;
+    int pitch;
+    int length;                // pixels the frame spans in each per-pixel buffer, padding included
+    enum buffer_layout layout;
+    uint32_t* color_buffer;
+    uint32_t* color_storage; // the color buffer owned by the render target
+    bool color_borrowed;     // color_buffer is presenter memory, which does not keep the previous frame
+    enum depth_format depth_format;
+    void* z_buffer;
+    uint32_t* visibility_buffer;
+    float* hiz_buffer;
+    int hiz_width;
+    int hiz_height;
+    rect_t* changed; // array.h array of rectangles covering the pixels that may differ from the last presented frame
+};
+
+// File formats for dumping frames: binary PPM (RGB), or raw RGBA bytes with no header
+enum frame_format {
+    FRAME_FORMAT_PPM,
+    FRAME_FORMAT_RAW
+};
+
+bool render_target_create(render_target_t* target, int width, int height, int pitch, enum buffer_layout layout, enum depth_format format);
+void render_target_destroy(render_target_t* target);
+
+// Marks only the pixels of rect (if not empty) as changed since the last presented frame
+void render_target_set_changed(render_target_t* target, rect_t rect);
+
+// Sets the size of the frames drawn into target, clamped to 1..max_width x 1..max_height
+void render_target_resize(render_target_t* target, int width, int height);
+
+// Makes target the one everything draws into, by pointing window_width, color_buffer, z_buffer, depth_format... at it
+void render_target_bind(const render_target_t* target);
+
+bool render_target_dump(const render_target_t* target, const char* filename, enum frame_format format);
+
+#endif
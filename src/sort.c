@@ -0,0 +1,92 @@
+#include <string.h>
+#include "array.h"
+#include "sort.h"
+
+#define SORT_RADIX_BITS 8
+#define SORT_RADIX_SIZE (1 << SORT_RADIX_BITS)
+#define SORT_PASSES (32 / SORT_RADIX_BITS)
+
+typedef struct {
+    uint32_t key;
+    int index;
+} sort_item_t;
+
+// Scratch dynamic arrays, kept between frames so sorting does not allocate once they are large enough
+static sort_item_t* items = NULL;
+static sort_item_t* items_swap = NULL;
+static triangle_t* triangles_sorted = NULL;
+
+/**
+*    Maps a float to an unsigned integer with the same ordering: positive floats get their sign bit set,
+*    negative floats have all bits flipped so that larger magnitudes come first.
+**/
+static uint32_t float_sort_key(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+}
+
+// Resizes a scratch dynamic array to exactly count items, reusing its capacity
+static void* array_resize(void* array, int count, int item_size) {
+    array_reset(array);
+    return array_hold(array, count, item_size);
+}
+
+void sort_triangles_by_depth(triangle_t* triangles, int num_triangles, enum sort_order order) {
+    if (num_triangles < 2) return;
+
+    items = array_resize(items, num_triangles, sizeof(sort_item_t));
+    items_swap = array_resize(items_swap, num_triangles, sizeof(sort_item_t));
+
+    // Build the keys and the histograms of every digit in one pass
+    int counts[SORT_PASSES][SORT_RADIX_SIZE];
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < num_triangles; i++) {
+        uint32_t key = float_sort_key(triangles[i].avg_depth);
+        // Inverting the key reverses the order and keeps the sort stable
+        if (order == SORT_BACK_TO_FRONT) key = ~key;
+        items[i].key = key;
+        items[i].index = i;
+        for (int pass = 0; pass < SORT_PASSES; pass++) {
+            counts[pass][(key >> (pass * SORT_RADIX_BITS)) & (SORT_RADIX_SIZE - 1)]++;
+        }
+    }
+
+    // Sort the (key, index) pairs one digit at a time, starting at the least significant digit
+    for (int pass = 0; pass < SORT_PASSES; pass++) {
+        int shift = pass * SORT_RADIX_BITS;
+
+        // All keys sharing this digit (usually the exponent bits) would leave the order unchanged
+        if (counts[pass][(items[0].key >> shift) & (SORT_RADIX_SIZE - 1)] == num_triangles) continue;
+
+        int offsets[SORT_RADIX_SIZE];
+        int offset = 0;
+        for (int digit = 0; digit < SORT_RADIX_SIZE; digit++) {
+            offsets[digit] = offset;
+            offset += counts[pass][digit];
+        }
+        for (int i = 0; i < num_triangles; i++) {
+            items_swap[offsets[(items[i].key >> shift) & (SORT_RADIX_SIZE - 1)]++] = items[i];
+        }
+
+        sort_item_t* temp = items;
+        items = items_swap;
+        items_swap = temp;
+    }
+
+    // Move the triangles into place once, through a scratch copy
+    triangles_sorted = array_resize(triangles_sorted, num_triangles, sizeof(triangle_t));
+    for (int i = 0; i < num_triangles; i++) {
+        triangles_sorted[i] = triangles[items[i].index];
+    }
+    memcpy(triangles, triangles_sorted, sizeof(triangle_t) * num_triangles);
+}
+
+void sort_free(void) {
+    array_free(items);
+    array_free(items_swap);
+    array_free(triangles_sorted);
+    items = NULL;
+    items_swap = NULL;
+    triangles_sorted = NULL;
+}
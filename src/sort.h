@@ -0,0 +1,19 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include "triangle.h"
+
+enum sort_order {
+    SORT_FRONT_TO_BACK, // nearest first, so the z-buffer and hierarchical z-buffer reject as much as possible
+    SORT_BACK_TO_FRONT  // farthest first, for the painter's algorithm
+};
+
+/**
+*    Sorts triangles by avg_depth with an LSD radix sort on an integer key made from the float depth.
+*    Runs in O(n), is stable (equal depths keep their order) and moves every triangle only once.
+**/
+void sort_triangles_by_depth(triangle_t* triangles, int num_triangles, enum sort_order order);
+
+void sort_free(void);
+
+#endif
@@ -0,0 +1,645 @@
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "span.h"
+#include "texture.h"
+
+/**
+*    The span kernels are written once as generic functions taking the pipeline state as plain arguments
+*    and instantiated for every state further down. They are force inlined into the instances, so each
+*    state argument is a constant there and the compiler drops the branches (and the work) that the state
+*    does not need from the pixel loops.
+**/
+#if defined(__GNUC__)
+#define SPAN_KERNEL static inline __attribute__((always_inline))
+#else
+#define SPAN_KERNEL static inline
+#endif
+
+int span_subdivision = 0;
+bool span_measure_error = false;
+
+// Largest measured UV error; it is never negative, so its float bits order the same way as integers
+static SDL_atomic_t max_error_bits;
+
+float span_max_error(void) {
+    int bits = SDL_AtomicGet(&max_error_bits);
+    float error;
+    memcpy(&error, &bits, sizeof(error));
+    return error;
+}
+
+static void span_record_error(float error) {
+    int bits;
+    memcpy(&bits, &error, sizeof(bits));
+    for (;;) {
+        int old_bits = SDL_AtomicGet(&max_error_bits);
+        if (bits <= old_bits || SDL_AtomicCAS(&max_error_bits, old_bits, bits)) break;
+    }
+}
+
+bool span_count_depth_fights = false;
+static SDL_atomic_t depth_fights;
+
+int span_take_depth_fights(void) {
+    return SDL_AtomicSet(&depth_fights, 0);
+}
+
+// Returns the span state advanced by count pixels
+static span_t span_advance(const span_t* span, int count) {
+    span_t s = *span;
+    for (int i = 0; i < 3; i++) {
+        s.e[i] += s.e_step[i] * count;
+    }
+    s.rw += s.rw_step * count;
+    s.uw += s.uw_step * count;
+    s.vw += s.vw_step * count;
+    return s;
+}
+
+// Whether the pixel count pixels into the span is covered
+static bool span_covers(const span_t* span, int count) {
+    return ((span->e[0] + span->e_step[0] * count) | (span->e[1] + span->e_step[1] * count) | (span->e[2] + span->e_step[2] * count)) >= 0;
+}
+
+#if defined(__SSE4_1__)
+
+/**
+*    Vectorized texel_wrap for texel coordinates below 2^24.
+*    For TEXEL_REPEAT the quotient is estimated with a float multiply and the remainder corrected by one
+*    step either way.
+**/
+SPAN_KERNEL __m128i texel_wrap_4(__m128i a, __m128i size, __m128 inv_size, int wrap) {
+    __m128i size_minus_one = _mm_sub_epi32(size, _mm_set1_epi32(1));
+    if (wrap == TEXEL_REPEAT_POW2) return _mm_and_si128(_mm_abs_epi32(a), size_minus_one);
+    if (wrap == TEXEL_CLAMP) return _mm_min_epi32(_mm_max_epi32(a, _mm_setzero_si128()), size_minus_one);
+
+    a = _mm_abs_epi32(a);
+    __m128i q = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(a), inv_size));
+    __m128i r = _mm_sub_epi32(a, _mm_mullo_epi32(q, size));
+    r = _mm_sub_epi32(r, _mm_and_si128(size, _mm_cmpgt_epi32(r, size_minus_one)));
+    r = _mm_add_epi32(r, _mm_and_si128(size, _mm_cmplt_epi32(r, _mm_setzero_si128())));
+    return r;
+}
+
+/**
+*    Depths of 4 adjacent pixels as integer lanes, for the vector loops: the float bits in float32, which
+*    are only ever compared as floats, and the zero extended unorm values otherwise. depth_key_4 turns
+*    depths computed by a span into the same representation.
+**/
+SPAN_KERNEL __m128i depth_load_4(const void* z_row, int x, int format) {
+    if (format == DEPTH_FORMAT_UNORM16) {
+        return _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)((const uint16_t*)z_row + x)));
+    }
+    if (format == DEPTH_FORMAT_UNORM24) {
+        // 12 bytes, loaded as 8 + 4 so nothing past the last pixel is read, spread to 3 bytes per lane
+        const uint8_t* bytes = (const uint8_t*)z_row + (x * 3);
+        int last;
+        memcpy(&last, bytes + 8, sizeof(last));
+        __m128i packed = _mm_insert_epi32(_mm_loadl_epi64((const __m128i*)bytes), last, 2);
+        return _mm_shuffle_epi8(packed, _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+    }
+    return _mm_loadu_si128((const __m128i*)((const float*)z_row + x));
+}
+
+SPAN_KERNEL void depth_store_4(void* z_row, int x, __m128i depths, int format) {
+    if (format == DEPTH_FORMAT_UNORM16) {
+        _mm_storel_epi64((__m128i*)((uint16_t*)z_row + x), _mm_packus_epi32(depths, depths));
+    } else if (format == DEPTH_FORMAT_UNORM24) {
+        uint8_t* bytes = (uint8_t*)z_row + (x * 3);
+        __m128i packed = _mm_shuffle_epi8(depths, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+        int last = _mm_extract_epi32(packed, 2);
+        _mm_storel_epi64((__m128i*)bytes, packed);
+        memcpy(bytes + 8, &last, sizeof(last));
+    } else {
+        _mm_storeu_si128((__m128i*)((float*)z_row + x), depths);
+    }
+}
+
+// Same clamping and truncation as depth_encode, with scale, bias and max from the depth_unorm functions
+SPAN_KERNEL __m128i depth_key_4(__m128 depth, __m128 scale, __m128 bias, __m128 max, int format) {
+    if (format == DEPTH_FORMAT_FLOAT32) return _mm_castps_si128(depth);
+    // min takes its second operand when the first is NaN, so NaN becomes max before the clamp at 0
+    __m128 value = _mm_min_ps(_mm_add_ps(_mm_mul_ps(depth, scale), bias), max);
+    return _mm_cvttps_epi32(_mm_max_ps(value, _mm_setzero_ps()));
+}
+
+// Lanes where key is nearer than z (depth_less_4), or equal to it (depth_equal_4)
+SPAN_KERNEL __m128 depth_less_4(__m128i key, __m128i z, int format) {
+    if (format == DEPTH_FORMAT_FLOAT32) return _mm_cmplt_ps(_mm_castsi128_ps(key), _mm_castsi128_ps(z));
+    return _mm_castsi128_ps(_mm_cmplt_epi32(key, z));
+}
+
+SPAN_KERNEL __m128 depth_equal_4(__m128i key, __m128i z, int format) {
+    if (format == DEPTH_FORMAT_FLOAT32) return _mm_cmpeq_ps(_mm_castsi128_ps(key), _mm_castsi128_ps(z));
+    return _mm_castsi128_ps(_mm_cmpeq_epi32(key, z));
+}
+
+#endif
+
+#if defined(__AVX2__)
+
+// 8 lane versions of the depth functions above
+SPAN_KERNEL __m256i depth_load_8(const void* z_row, int x, int format) {
+    if (format == DEPTH_FORMAT_UNORM16) {
+        return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)((const uint16_t*)z_row + x)));
+    }
+    if (format == DEPTH_FORMAT_UNORM24) {
+        return _mm256_set_m128i(depth_load_4(z_row, x + 4, format), depth_load_4(z_row, x, format));
+    }
+    return _mm256_loadu_si256((const __m256i*)((const float*)z_row + x));
+}
+
+SPAN_KERNEL void depth_store_8(void* z_row, int x, __m256i depths, int format) {
+    if (format == DEPTH_FORMAT_UNORM16) {
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(depths), _mm256_extracti128_si256(depths, 1));
+        _mm_storeu_si128((__m128i*)((uint16_t*)z_row + x), packed);
+    } else if (format == DEPTH_FORMAT_UNORM24) {
+        depth_store_4(z_row, x, _mm256_castsi256_si128(depths), format);
+        depth_store_4(z_row, x + 4, _mm256_extracti128_si256(depths, 1), format);
+    } else {
+        _mm256_storeu_si256((__m256i*)((float*)z_row + x), depths);
+    }
+}
+
+SPAN_KERNEL __m256i depth_key_8(__m256 depth, __m256 scale, __m256 bias, __m256 max, int format) {
+    if (format == DEPTH_FORMAT_FLOAT32) return _mm256_castps_si256(depth);
+    __m256 value = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(depth, scale), bias), max);
+    return _mm256_cvttps_epi32(_mm256_max_ps(value, _mm256_setzero_ps()));
+}
+
+SPAN_KERNEL __m256 depth_less_8(__m256i key, __m256i z, int format) {
+    if (format == DEPTH_FORMAT_FLOAT32) return _mm256_cmp_ps(_mm256_castsi256_ps(key), _mm256_castsi256_ps(z), _CMP_LT_OQ);
+    return _mm256_castsi256_ps(_mm256_cmpgt_epi32(z, key));
+}
+
+SPAN_KERNEL __m256 depth_equal_8(__m256i key, __m256i z, int format) {
+    if (format == DEPTH_FORMAT_FLOAT32) return _mm256_cmp_ps(_mm256_castsi256_ps(key), _mm256_castsi256_ps(z), _CMP_EQ_OQ);
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(key, z));
+}
+
+#endif
+
+SPAN_KERNEL bool filled_span_kernel(
+    uint32_t* color_row, void* z_row, int x_start, int x_end, const span_t* span, uint32_t color,
+    bool depth_test, bool depth_write, int format
+) {
+    int x = x_start;
+    bool written = false;
+    bool count_fights = depth_test && span_count_depth_fights;
+    int fights = 0;
+#if defined(__AVX2__)
+    if (x_end - x_start + 1 >= 8) {
+        __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i e0 = _mm256_add_epi32(_mm256_set1_epi32(span->e[0]), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span->e_step[0])));
+        __m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(span->e[1]), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span->e_step[1])));
+        __m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(span->e[2]), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span->e_step[2])));
+        __m256i e0_step = _mm256_set1_epi32(span->e_step[0] * 8);
+        __m256i e1_step = _mm256_set1_epi32(span->e_step[1] * 8);
+        __m256i e2_step = _mm256_set1_epi32(span->e_step[2] * 8);
+        __m256 rw = _mm256_add_ps(_mm256_set1_ps(span->rw), _mm256_mul_ps(_mm256_cvtepi32_ps(lane), _mm256_set1_ps(span->rw_step)));
+        __m256 rw_step = _mm256_set1_ps(span->rw_step * 8);
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 depth_scale = _mm256_set1_ps(depth_unorm_scale(format));
+        __m256 depth_bias = _mm256_set1_ps(depth_unorm_bias(format));
+        __m256 depth_max = _mm256_set1_ps((float)depth_unorm_max(format));
+        __m256i minus_one = _mm256_set1_epi32(-1);
+        __m256 colors = _mm256_castsi256_ps(_mm256_set1_epi32((int)color));
+
+        for (; x + 7 <= x_end; x += 8) {
+            __m256 pass = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(e0, e1), e2), minus_one));
+            __m256i depth = _mm256_setzero_si256();
+            __m256i z = _mm256_setzero_si256();
+            if (depth_test || depth_write) {
+                depth = depth_key_8(_mm256_sub_ps(one, rw), depth_scale, depth_bias, depth_max, format);
+                z = depth_load_8(z_row, x, format);
+            }
+            if (count_fights) fights += __builtin_popcount(_mm256_movemask_ps(_mm256_and_ps(pass, depth_equal_8(depth, z, format))));
+            if (depth_test) pass = _mm256_and_ps(pass, depth_less_8(depth, z, format));
+            int mask = _mm256_movemask_ps(pass);
+            if (mask == 0xFF) {
+                _mm256_storeu_ps((float*)&color_row[x], colors);
+                if (depth_write) depth_store_8(z_row, x, depth, format);
+                written = true;
+            } else if (mask) {
+                __m256 old_colors = _mm256_loadu_ps((float*)&color_row[x]);
+                _mm256_storeu_ps((float*)&color_row[x], _mm256_blendv_ps(old_colors, colors, pass));
+                if (depth_write) depth_store_8(z_row, x, _mm256_blendv_epi8(z, depth, _mm256_castps_si256(pass)), format);
+                written = true;
+            }
+            e0 = _mm256_add_epi32(e0, e0_step);
+            e1 = _mm256_add_epi32(e1, e1_step);
+            e2 = _mm256_add_epi32(e2, e2_step);
+            if (depth_test || depth_write) rw = _mm256_add_ps(rw, rw_step);
+        }
+    }
+#elif defined(__SSE4_1__)
+    if (x_end - x_start + 1 >= 4) {
+        __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+        __m128i e0 = _mm_add_epi32(_mm_set1_epi32(span->e[0]), _mm_mullo_epi32(lane, _mm_set1_epi32(span->e_step[0])));
+        __m128i e1 = _mm_add_epi32(_mm_set1_epi32(span->e[1]), _mm_mullo_epi32(lane, _mm_set1_epi32(span->e_step[1])));
+        __m128i e2 = _mm_add_epi32(_mm_set1_epi32(span->e[2]), _mm_mullo_epi32(lane, _mm_set1_epi32(span->e_step[2])));
+        __m128i e0_step = _mm_set1_epi32(span->e_step[0] * 4);
+        __m128i e1_step = _mm_set1_epi32(span->e_step[1] * 4);
+        __m128i e2_step = _mm_set1_epi32(span->e_step[2] * 4);
+        __m128 rw = _mm_add_ps(_mm_set1_ps(span->rw), _mm_mul_ps(_mm_cvtepi32_ps(lane), _mm_set1_ps(span->rw_step)));
+        __m128 rw_step = _mm_set1_ps(span->rw_step * 4);
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 depth_scale = _mm_set1_ps(depth_unorm_scale(format));
+        __m128 depth_bias = _mm_set1_ps(depth_unorm_bias(format));
+        __m128 depth_max = _mm_set1_ps((float)depth_unorm_max(format));
+        __m128i minus_one = _mm_set1_epi32(-1);
+        __m128 colors = _mm_castsi128_ps(_mm_set1_epi32((int)color));
+
+        for (; x + 3 <= x_end; x += 4) {
+            __m128 pass = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(e0, e1), e2), minus_one));
+            __m128i depth = _mm_setzero_si128();
+            __m128i z = _mm_setzero_si128();
+            if (depth_test || depth_write) {
+                depth = depth_key_4(_mm_sub_ps(one, rw), depth_scale, depth_bias, depth_max, format);
+                z = depth_load_4(z_row, x, format);
+            }
+            if (count_fights) fights += __builtin_popcount(_mm_movemask_ps(_mm_and_ps(pass, depth_equal_4(depth, z, format))));
+            if (depth_test) pass = _mm_and_ps(pass, depth_less_4(depth, z, format));
+            int mask = _mm_movemask_ps(pass);
+            if (mask == 0xF) {
+                _mm_storeu_ps((float*)&color_row[x], colors);
+                if (depth_write) depth_store_4(z_row, x, depth, format);
+                written = true;
+            } else if (mask) {
+                __m128 old_colors = _mm_loadu_ps((float*)&color_row[x]);
+                _mm_storeu_ps((float*)&color_row[x], _mm_blendv_ps(old_colors, colors, pass));
+                if (depth_write) depth_store_4(z_row, x, _mm_blendv_epi8(z, depth, _mm_castps_si128(pass)), format);
+                written = true;
+            }
+            e0 = _mm_add_epi32(e0, e0_step);
+            e1 = _mm_add_epi32(e1, e1_step);
+            e2 = _mm_add_epi32(e2, e2_step);
+            if (depth_test || depth_write) rw = _mm_add_ps(rw, rw_step);
+        }
+    }
+#endif
+    span_t s = span_advance(span, x - x_start);
+    for (; x <= x_end; x++) {
+        // The pixel is inside when all three edge values are non-negative (no sign bit set)
+        if ((s.e[0] | s.e[1] | s.e[2]) >= 0) {
+            float depth = 1 - s.rw;
+            int order = depth_test ? depth_compare(format, z_row, x, depth) : -1;
+            if (count_fights && order == 0) fights++;
+            if (order < 0) {
+                color_row[x] = color;
+                if (depth_write) depth_store(format, z_row, x, depth);
+                written = true;
+            }
+        }
+        s.e[0] += s.e_step[0];
+        s.e[1] += s.e_step[1];
+        s.e[2] += s.e_step[2];
+        if (depth_test || depth_write) s.rw += s.rw_step;
+    }
+    if (fights) SDL_AtomicAdd(&depth_fights, fights);
+    return written;
+}
+
+SPAN_KERNEL bool textured_span_kernel(
+    uint32_t* color_row, void* z_row, int x_start, int x_end, const span_t* span, uint32_t* texture,
+    bool depth_test, bool depth_write, int format, int wrap
+) {
+    int x = x_start;
+    bool written = false;
+    bool count_fights = depth_test && span_count_depth_fights;
+    int fights = 0;
+#if defined(__AVX2__)
+    if (x_end - x_start + 1 >= 8) {
+        __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256 lane_f = _mm256_cvtepi32_ps(lane);
+        __m256i e0 = _mm256_add_epi32(_mm256_set1_epi32(span->e[0]), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span->e_step[0])));
+        __m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(span->e[1]), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span->e_step[1])));
+        __m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(span->e[2]), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span->e_step[2])));
+        __m256i e0_step = _mm256_set1_epi32(span->e_step[0] * 8);
+        __m256i e1_step = _mm256_set1_epi32(span->e_step[1] * 8);
+        __m256i e2_step = _mm256_set1_epi32(span->e_step[2] * 8);
+        __m256 rw = _mm256_add_ps(_mm256_set1_ps(span->rw), _mm256_mul_ps(lane_f, _mm256_set1_ps(span->rw_step)));
+        __m256 uw = _mm256_add_ps(_mm256_set1_ps(span->uw), _mm256_mul_ps(lane_f, _mm256_set1_ps(span->uw_step)));
+        __m256 vw = _mm256_add_ps(_mm256_set1_ps(span->vw), _mm256_mul_ps(lane_f, _mm256_set1_ps(span->vw_step)));
+        __m256 rw_step = _mm256_set1_ps(span->rw_step * 8);
+        __m256 uw_step = _mm256_set1_ps(span->uw_step * 8);
+        __m256 vw_step = _mm256_set1_ps(span->vw_step * 8);
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 depth_scale = _mm256_set1_ps(depth_unorm_scale(format));
+        __m256 depth_bias = _mm256_set1_ps(depth_unorm_bias(format));
+        __m256 depth_max = _mm256_set1_ps((float)depth_unorm_max(format));
+        __m256i minus_one = _mm256_set1_epi32(-1);
+        __m256 tex_w = _mm256_set1_ps((float)texture_width);
+        __m256 tex_h = _mm256_set1_ps((float)texture_height);
+        __m128i tex_w_i = _mm_set1_epi32(texture_width);
+        __m128i tex_h_i = _mm_set1_epi32(texture_height);
+        __m128 inv_tex_w = _mm_set1_ps(1.0f / texture_width);
+        __m128 inv_tex_h = _mm_set1_ps(1.0f / texture_height);
+
+        for (; x + 7 <= x_end; x += 8) {
+            __m256 pass = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(e0, e1), e2), minus_one));
+            __m256i depth = _mm256_setzero_si256();
+            __m256i z = _mm256_setzero_si256();
+            if (depth_test || depth_write) {
+                depth = depth_key_8(_mm256_sub_ps(one, rw), depth_scale, depth_bias, depth_max, format);
+                z = depth_load_8(z_row, x, format);
+            }
+            if (count_fights) fights += __builtin_popcount(_mm256_movemask_ps(_mm256_and_ps(pass, depth_equal_8(depth, z, format))));
+            if (depth_test) pass = _mm256_and_ps(pass, depth_less_8(depth, z, format));
+            if (_mm256_movemask_ps(pass)) {
+                // Perspective correct UV mapped to texel coordinates, wrapped 4 lanes at a time
+                __m256 w = _mm256_div_ps(one, rw);
+                __m256i tex_x = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_mul_ps(uw, w), tex_w));
+                __m256i tex_y = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_mul_ps(vw, w), tex_h));
+                __m128i tex_x_lo = texel_wrap_4(_mm256_castsi256_si128(tex_x), tex_w_i, inv_tex_w, wrap);
+                __m128i tex_x_hi = texel_wrap_4(_mm256_extracti128_si256(tex_x, 1), tex_w_i, inv_tex_w, wrap);
+                __m128i tex_y_lo = texel_wrap_4(_mm256_castsi256_si128(tex_y), tex_h_i, inv_tex_h, wrap);
+                __m128i tex_y_hi = texel_wrap_4(_mm256_extracti128_si256(tex_y, 1), tex_h_i, inv_tex_h, wrap);
+                __m256i index = _mm256_add_epi32(
+                    _mm256_mullo_epi32(_mm256_set_m128i(tex_y_hi, tex_y_lo), _mm256_set1_epi32(texture_width)),
+                    _mm256_set_m128i(tex_x_hi, tex_x_lo)
+                );
+
+                // Masked gather keeps the current color in the lanes that failed coverage or depth
+                __m256i old_colors = _mm256_loadu_si256((__m256i*)&color_row[x]);
+                __m256i colors = _mm256_mask_i32gather_epi32(old_colors, (const int*)texture, index, _mm256_castps_si256(pass), 4);
+                _mm256_storeu_si256((__m256i*)&color_row[x], colors);
+                if (depth_write) depth_store_8(z_row, x, _mm256_blendv_epi8(z, depth, _mm256_castps_si256(pass)), format);
+                written = true;
+            }
+            e0 = _mm256_add_epi32(e0, e0_step);
+            e1 = _mm256_add_epi32(e1, e1_step);
+            e2 = _mm256_add_epi32(e2, e2_step);
+            rw = _mm256_add_ps(rw, rw_step);
+            uw = _mm256_add_ps(uw, uw_step);
+            vw = _mm256_add_ps(vw, vw_step);
+        }
+    }
+#elif defined(__SSE4_1__)
+    if (x_end - x_start + 1 >= 4) {
+        __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+        __m128 lane_f = _mm_cvtepi32_ps(lane);
+        __m128i e0 = _mm_add_epi32(_mm_set1_epi32(span->e[0]), _mm_mullo_epi32(lane, _mm_set1_epi32(span->e_step[0])));
+        __m128i e1 = _mm_add_epi32(_mm_set1_epi32(span->e[1]), _mm_mullo_epi32(lane, _mm_set1_epi32(span->e_step[1])));
+        __m128i e2 = _mm_add_epi32(_mm_set1_epi32(span->e[2]), _mm_mullo_epi32(lane, _mm_set1_epi32(span->e_step[2])));
+        __m128i e0_step = _mm_set1_epi32(span->e_step[0] * 4);
+        __m128i e1_step = _mm_set1_epi32(span->e_step[1] * 4);
+        __m128i e2_step = _mm_set1_epi32(span->e_step[2] * 4);
+        __m128 rw = _mm_add_ps(_mm_set1_ps(span->rw), _mm_mul_ps(lane_f, _mm_set1_ps(span->rw_step)));
+        __m128 uw = _mm_add_ps(_mm_set1_ps(span->uw), _mm_mul_ps(lane_f, _mm_set1_ps(span->uw_step)));
+        __m128 vw = _mm_add_ps(_mm_set1_ps(span->vw), _mm_mul_ps(lane_f, _mm_set1_ps(span->vw_step)));
+        __m128 rw_step = _mm_set1_ps(span->rw_step * 4);
+        __m128 uw_step = _mm_set1_ps(span->uw_step * 4);
+        __m128 vw_step = _mm_set1_ps(span->vw_step * 4);
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 depth_scale = _mm_set1_ps(depth_unorm_scale(format));
+        __m128 depth_bias = _mm_set1_ps(depth_unorm_bias(format));
+        __m128 depth_max = _mm_set1_ps((float)depth_unorm_max(format));
+        __m128i minus_one = _mm_set1_epi32(-1);
+        __m128 tex_w = _mm_set1_ps((float)texture_width);
+        __m128 tex_h = _mm_set1_ps((float)texture_height);
+        __m128i tex_w_i = _mm_set1_epi32(texture_width);
+        __m128i tex_h_i = _mm_set1_epi32(texture_height);
+        __m128 inv_tex_w = _mm_set1_ps(1.0f / texture_width);
+        __m128 inv_tex_h = _mm_set1_ps(1.0f / texture_height);
+
+        for (; x + 3 <= x_end; x += 4) {
+            __m128 pass = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(e0, e1), e2), minus_one));
+            __m128i depth = _mm_setzero_si128();
+            __m128i z = _mm_setzero_si128();
+            if (depth_test || depth_write) {
+                depth = depth_key_4(_mm_sub_ps(one, rw), depth_scale, depth_bias, depth_max, format);
+                z = depth_load_4(z_row, x, format);
+            }
+            if (count_fights) fights += __builtin_popcount(_mm_movemask_ps(_mm_and_ps(pass, depth_equal_4(depth, z, format))));
+            if (depth_test) pass = _mm_and_ps(pass, depth_less_4(depth, z, format));
+            int mask = _mm_movemask_ps(pass);
+            if (mask) {
+                // Perspective correct UV mapped to wrapped texel coordinates
+                __m128 w = _mm_div_ps(one, rw);
+                __m128i tex_x = texel_wrap_4(_mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(uw, w), tex_w)), tex_w_i, inv_tex_w, wrap);
+                __m128i tex_y = texel_wrap_4(_mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(vw, w), tex_h)), tex_h_i, inv_tex_h, wrap);
+                int index[4];
+                _mm_storeu_si128((__m128i*)index, _mm_add_epi32(_mm_mullo_epi32(tex_y, tex_w_i), tex_x));
+
+                // No gather before AVX2: fetch and store the texels of the passing lanes one by one
+                for (int i = 0; i < 4; i++) {
+                    if (mask & (1 << i)) {
+                        color_row[x + i] = texture[index[i]];
+                    }
+                }
+                if (depth_write) depth_store_4(z_row, x, _mm_blendv_epi8(z, depth, _mm_castps_si128(pass)), format);
+                written = true;
+            }
+            e0 = _mm_add_epi32(e0, e0_step);
+            e1 = _mm_add_epi32(e1, e1_step);
+            e2 = _mm_add_epi32(e2, e2_step);
+            rw = _mm_add_ps(rw, rw_step);
+            uw = _mm_add_ps(uw, uw_step);
+            vw = _mm_add_ps(vw, vw_step);
+        }
+    }
+#endif
+    span_t s = span_advance(span, x - x_start);
+    for (; x <= x_end; x++) {
+        if ((s.e[0] | s.e[1] | s.e[2]) >= 0) {
+            float depth = 1 - s.rw;
+            int order = depth_test ? depth_compare(format, z_row, x, depth) : -1;
+            if (count_fights && order == 0) fights++;
+            if (order < 0) {
+                // Divide back by the interpolated 1/w to get the perspective correct UV
+                float w = 1 / s.rw;
+                int tex_x = texel_wrap((int)(s.uw * w * texture_width), texture_width, wrap);
+                int tex_y = texel_wrap((int)(s.vw * w * texture_height), texture_height, wrap);
+                color_row[x] = texture[(texture_width * tex_y) + tex_x];
+                if (depth_write) depth_store(format, z_row, x, depth);
+                written = true;
+            }
+        }
+        s.e[0] += s.e_step[0];
+        s.e[1] += s.e_step[1];
+        s.e[2] += s.e_step[2];
+        s.rw += s.rw_step;
+        s.uw += s.uw_step;
+        s.vw += s.vw_step;
+    }
+    if (fights) SDL_AtomicAdd(&depth_fights, fights);
+    return written;
+}
+
+/**
+*    Textured span with affine subdivision. The covered pixels of a row are contiguous, so they are found
+*    first and cut into segments of span_subdivision pixels. The exact UV is only computed at the segment
+*    ends, which are covered pixels where 1/w is known to be positive, and stepped linearly in between.
+**/
+SPAN_KERNEL bool textured_span_subdivided_kernel(
+    uint32_t* color_row, void* z_row, int x_start, int x_end, const span_t* span, uint32_t* texture,
+    bool depth_test, bool depth_write, int format, int wrap
+) {
+    int first = 0;
+    int last = x_end - x_start;
+    while (first <= last && !span_covers(span, first)) first++;
+    while (last >= first && !span_covers(span, last)) last--;
+    if (first > last) return false;
+
+    bool written = false;
+    bool count_fights = depth_test && span_count_depth_fights;
+    int fights = 0;
+    float max_error = 0;
+    span_t s = span_advance(span, first);
+    float u = s.uw / s.rw;
+    float v = s.vw / s.rw;
+    for (int x = x_start + first; x <= x_start + last;) {
+        // Each segment ends at the next pixel with an exact UV, at most span_subdivision pixels away
+        int count = x_start + last - x;
+        if (count > span_subdivision) count = span_subdivision;
+
+        span_t next = s;
+        float u_next = u;
+        float v_next = v;
+        float u_step = 0;
+        float v_step = 0;
+        if (count > 0) {
+            next = span_advance(&s, count);
+            u_next = next.uw / next.rw;
+            v_next = next.vw / next.rw;
+            u_step = (u_next - u) / count;
+            v_step = (v_next - v) / count;
+        } else {
+            count = 1; // only the last pixel is left, and its UV is exact already
+        }
+
+        for (int i = 0; i < count; i++, x++) {
+            float depth = 1 - s.rw;
+            int order = depth_test ? depth_compare(format, z_row, x, depth) : -1;
+            if (count_fights && order == 0) fights++;
+            if (order < 0) {
+                int tex_x = texel_wrap((int)(u * texture_width), texture_width, wrap);
+                int tex_y = texel_wrap((int)(v * texture_height), texture_height, wrap);
+                color_row[x] = texture[(texture_width * tex_y) + tex_x];
+                if (depth_write) depth_store(format, z_row, x, depth);
+                written = true;
+            }
+            if (span_measure_error) {
+                float error_u = fabsf(s.uw / s.rw - u) * texture_width;
+                float error_v = fabsf(s.vw / s.rw - v) * texture_height;
+                if (error_u > max_error) max_error = error_u;
+                if (error_v > max_error) max_error = error_v;
+            }
+            s.rw += s.rw_step;
+            s.uw += s.uw_step;
+            s.vw += s.vw_step;
+            u += u_step;
+            v += v_step;
+        }
+        // Restart from the exact values so the error does not build up over the segments
+        s = next;
+        u = u_next;
+        v = v_next;
+    }
+    if (span_measure_error) span_record_error(max_error);
+    if (fights) SDL_AtomicAdd(&depth_fights, fights);
+    return written;
+}
+
+// Instantiates the filled span kernel for one depth state and format
+#define FILLED_SPAN(name, depth_test, depth_write, format)                                                 \
+    static bool name(uint32_t* color_row, void* z_row, int x_start, int x_end, const span_t* span, uint32_t color) { \
+        return filled_span_kernel(color_row, z_row, x_start, x_end, span, color, depth_test, depth_write, format); \
+    }
+
+// Instantiates the filled span kernels of one depth format for every depth state
+#define FILLED_SPANS_ALL_STATES(name, format)             \
+    FILLED_SPAN(name, false, false, format)               \
+    FILLED_SPAN(name##_write, false, true, format)        \
+    FILLED_SPAN(name##_test, true, false, format)         \
+    FILLED_SPAN(name##_test_write, true, true, format)
+
+// Instantiates the exact and the subdivided textured span kernels for one depth state, format and texel wrap
+#define TEXTURED_SPANS(name, depth_test, depth_write, format, wrap)                                          \
+    static bool name(uint32_t* color_row, void* z_row, int x_start, int x_end, const span_t* span, uint32_t* texture) { \
+        return textured_span_kernel(color_row, z_row, x_start, x_end, span, texture, depth_test, depth_write, format, wrap); \
+    }                                                                                                        \
+    static bool name##_subdivided(uint32_t* color_row, void* z_row, int x_start, int x_end, const span_t* span, uint32_t* texture) { \
+        return textured_span_subdivided_kernel(color_row, z_row, x_start, x_end, span, texture, depth_test, depth_write, format, wrap); \
+    }
+
+// Instantiates the textured span kernels of one depth state and format for every texel wrap
+#define TEXTURED_SPANS_ALL_WRAPS(name, depth_test, depth_write, format)                     \
+    TEXTURED_SPANS(name##_repeat, depth_test, depth_write, format, TEXEL_REPEAT)           \
+    TEXTURED_SPANS(name##_repeat_pow2, depth_test, depth_write, format, TEXEL_REPEAT_POW2) \
+    TEXTURED_SPANS(name##_clamp, depth_test, depth_write, format, TEXEL_CLAMP)
+
+// Instantiates the textured span kernels of one depth format for every depth state and texel wrap
+#define TEXTURED_SPANS_ALL_STATES(name, format)                     \
+    TEXTURED_SPANS_ALL_WRAPS(name, false, false, format)            \
+    TEXTURED_SPANS_ALL_WRAPS(name##_write, false, true, format)     \
+    TEXTURED_SPANS_ALL_WRAPS(name##_test, true, false, format)      \
+    TEXTURED_SPANS_ALL_WRAPS(name##_test_write, true, true, format)
+
+FILLED_SPANS_ALL_STATES(filled_span_float32, DEPTH_FORMAT_FLOAT32)
+FILLED_SPANS_ALL_STATES(filled_span_unorm24, DEPTH_FORMAT_UNORM24)
+FILLED_SPANS_ALL_STATES(filled_span_unorm16, DEPTH_FORMAT_UNORM16)
+
+TEXTURED_SPANS_ALL_STATES(textured_span_float32, DEPTH_FORMAT_FLOAT32)
+TEXTURED_SPANS_ALL_STATES(textured_span_unorm24, DEPTH_FORMAT_UNORM24)
+TEXTURED_SPANS_ALL_STATES(textured_span_unorm16, DEPTH_FORMAT_UNORM16)
+
+// Kernel tables indexed by [depth format][depth_test][depth_write] (and then by texel wrap)
+#define FILLED_SPAN_TABLE(name) \
+    {{name, name##_write}, {name##_test, name##_test_write}}
+
+static const filled_span_fn filled_spans[3][2][2] = {
+    FILLED_SPAN_TABLE(filled_span_float32),
+    FILLED_SPAN_TABLE(filled_span_unorm24),
+    FILLED_SPAN_TABLE(filled_span_unorm16)
+};
+
+#define TEXTURED_SPAN_WRAPS(name, suffix) \
+    {name##_repeat##suffix, name##_repeat_pow2##suffix, name##_clamp##suffix}
+
+#define TEXTURED_SPAN_TABLE(name, suffix)                                                             \
+    {                                                                                                 \
+        {TEXTURED_SPAN_WRAPS(name, suffix), TEXTURED_SPAN_WRAPS(name##_write, suffix)},               \
+        {TEXTURED_SPAN_WRAPS(name##_test, suffix), TEXTURED_SPAN_WRAPS(name##_test_write, suffix)}    \
+    }
+
+static const textured_span_fn textured_spans[3][2][2][3] = {
+    TEXTURED_SPAN_TABLE(textured_span_float32, ),
+    TEXTURED_SPAN_TABLE(textured_span_unorm24, ),
+    TEXTURED_SPAN_TABLE(textured_span_unorm16, )
+};
+
+static const textured_span_fn textured_spans_subdivided[3][2][2][3] = {
+    TEXTURED_SPAN_TABLE(textured_span_float32, _subdivided),
+    TEXTURED_SPAN_TABLE(textured_span_unorm24, _subdivided),
+    TEXTURED_SPAN_TABLE(textured_span_unorm16, _subdivided)
+};
+
+static bool is_power_of_two(int n) {
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+filled_span_fn span_select_filled(enum depth_format format, bool depth_test, bool depth_write) {
+    return filled_spans[format][depth_test][depth_write];
+}
+
+int span_texel_wrap(enum texture_wrap wrap) {
+    if (wrap == TEXTURE_WRAP_CLAMP) return TEXEL_CLAMP;
+    return (is_power_of_two(texture_width) && is_power_of_two(texture_height)) ? TEXEL_REPEAT_POW2 : TEXEL_REPEAT;
+}
+
+textured_span_fn span_select_textured(enum depth_format format, bool depth_test, bool depth_write, enum texture_wrap wrap) {
+    int texel = span_texel_wrap(wrap);
+    if (span_subdivision > 1) {
+        return textured_spans_subdivided[format][depth_test][depth_write][texel];
+    }
+    return textured_spans[format][depth_test][depth_write][texel];
+}
@@ -0,0 +1,85 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "depth.h"
+
+/**
+*    State of a triangle along one row of pixels: the edge function values and the screen space linear
+*    interpolants at the first pixel of the span, plus their increments per pixel to the right.
+*    A pixel is covered when all three edge values are non-negative.
+**/
+typedef struct {
+    int e[3];
+    int e_step[3];
+    float rw;      // 1/w
+    float uw;      // u/w
+    float vw;      // v/w
+    float rw_step;
+    float uw_step;
+    float vw_step;
+} span_t;
+
+/**
+*    Affine subdivision of textured spans: with span_subdivision = N > 1 the perspective correct UV is
+*    only computed every N pixels and interpolated linearly in between, trading accuracy for one
+*    reciprocal per N pixels. 0 (or 1) computes it exactly at every pixel.
+*    With span_measure_error set, subdivided spans also compute the exact UV at every pixel and track
+*    the largest difference, in texels, which span_max_error returns.
+**/
+extern int span_subdivision;
+extern bool span_measure_error;
+float span_max_error(void);
+
+/**
+*    With span_count_depth_fights set, depth tested spans count the covered pixels whose depth equals the
+*    stored one in the precision of the depth format. Those fail the test whichever surface is nearer, so
+*    the count shows how much a compact depth format loses. span_take_depth_fights returns the count since
+*    the last call.
+**/
+extern bool span_count_depth_fights;
+int span_take_depth_fights(void);
+
+// How texture coordinates outside of 0..1 are mapped into the texture
+enum texture_wrap {
+    TEXTURE_WRAP_REPEAT, // tile the texture
+    TEXTURE_WRAP_CLAMP   // stretch the border texels
+};
+
+// How texel coordinates are brought into the texture, resolved from texture_wrap and the texture size
+#define TEXEL_REPEAT 0      // abs(x) % size
+#define TEXEL_REPEAT_POW2 1 // abs(x) & (size - 1), the same for power of two sizes
+#define TEXEL_CLAMP 2       // clamped to 0..size-1
+
+// Resolves wrap into a TEXEL_ mode for the current texture_width and texture_height
+int span_texel_wrap(enum texture_wrap wrap);
+
+// Brings texel coordinate a into 0..size-1; called with a constant wrap, only that mode's code is left
+static inline int texel_wrap(int a, int size, int wrap) {
+    if (wrap == TEXEL_REPEAT_POW2) return abs(a) & (size - 1);
+    if (wrap == TEXEL_CLAMP) return (a < 0) ? 0 : (a >= size) ? size - 1 : a;
+    return abs(a) % size;
+}
+
+/**
+*    Shade the covered pixels x_start..x_end (inclusive) of a row, optionally depth testing them against
+*    and writing their depth (1 - 1/w) into z_row, a row of a z-buffer in the depth format the kernel was
+*    selected for. Returns whether any pixel was written.
+*    With SSE4.1 (or AVX2) enabled at compile time these shade 4 (or 8) adjacent pixels per iteration:
+*    coverage and depth test become masked compares and the depth and color stores are masked blends.
+**/
+typedef bool (*filled_span_fn)(uint32_t* color_row, void* z_row, int x_start, int x_end, const span_t* span, uint32_t color);
+typedef bool (*textured_span_fn)(uint32_t* color_row, void* z_row, int x_start, int x_end, const span_t* span, uint32_t* texture);
+
+/**
+*    Return the span kernel specialized for a pipeline state and depth format, which only does the work
+*    that state needs.
+*    The textured kernel also depends on whether texture_width and texture_height are powers of two and
+*    on span_subdivision, so it has to be selected again when those change.
+**/
+filled_span_fn span_select_filled(enum depth_format format, bool depth_test, bool depth_write);
+textured_span_fn span_select_textured(enum depth_format format, bool depth_test, bool depth_write, enum texture_wrap wrap);
+
+#endif
@@ -0,0 +1,278 @@
+#include <limits.h>
+#include <SDL2/SDL.h>
+#include "array.h"
+#include "tiler.h"
+
+int tiler_thread_count = 1;
+
+static int tiles_x = 0;
+static int tiles_y = 0;
+static int** tile_bins = NULL; // per tile dynamic array of triangle indices
+
+/**
+*    Per tile rectangles, empty (min > max) when there are none: the pixels drawn into since the tile was
+*    last cleared, and the pixels changed since the last tiler_take_changed. Both are bounding boxes of
+*    whole hierarchical z blocks, which is what clear_z_buffer_rect needs.
+**/
+static rect_t* tile_dirty = NULL;
+static rect_t* tile_changed = NULL;
+static const rect_t empty_rect = {INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+
+static bool rect_empty(rect_t rect) {
+    return rect.min_x > rect.max_x || rect.min_y > rect.max_y;
+}
+
+static rect_t rect_union(rect_t a, rect_t b) {
+    rect_t rect = a;
+    if (b.min_x < rect.min_x) rect.min_x = b.min_x;
+    if (b.min_y < rect.min_y) rect.min_y = b.min_y;
+    if (b.max_x > rect.max_x) rect.max_x = b.max_x;
+    if (b.max_y > rect.max_y) rect.max_y = b.max_y;
+    return rect;
+}
+
+static rect_t rect_intersection(rect_t a, rect_t b) {
+    rect_t rect = a;
+    if (b.min_x > rect.min_x) rect.min_x = b.min_x;
+    if (b.min_y > rect.min_y) rect.min_y = b.min_y;
+    if (b.max_x < rect.max_x) rect.max_x = b.max_x;
+    if (b.max_y < rect.max_y) rect.max_y = b.max_y;
+    return rect;
+}
+
+// Pixels of tile number tile that are inside the render target
+static rect_t tile_rect(int tile) {
+    rect_t rect;
+    rect.min_x = (tile % tiles_x) * TILE_SIZE;
+    rect.min_y = (tile / tiles_x) * TILE_SIZE;
+    rect.max_x = rect.min_x + TILE_SIZE - 1;
+    rect.max_y = rect.min_y + TILE_SIZE - 1;
+    return rect_intersection(rect, screen_rect());
+}
+
+static SDL_Thread** workers = NULL;
+static SDL_sem* work_ready = NULL;
+static SDL_sem* work_done = NULL;
+static bool workers_quit = false;
+
+// The job that is currently being processed: drawing binned triangles, or a full-screen pass
+static tiler_draw_fn job_draw = NULL;
+static tiler_tile_fn job_run = NULL;
+static bool job_touched_only = false; // job_run only visits the touched tiles, and leaves them untouched
+static SDL_atomic_t job_next_tile;
+
+// Claims tiles until there are none left and draws their bins
+static void tiler_process_tiles(void) {
+    int num_tiles = tiles_x * tiles_y;
+    for (;;) {
+        int tile = SDL_AtomicAdd(&job_next_tile, 1);
+        if (tile >= num_tiles) break;
+
+        int* bin = tile_bins[tile];
+        int num_binned = array_length(bin);
+        if (!job_run && num_binned == 0) continue;
+
+        rect_t clip = tile_rect(tile);
+        if (job_touched_only) clip = rect_intersection(clip, tile_dirty[tile]);
+        // Tiles past the edges of a render target drawn below its full size, or with nothing to clear
+        if (rect_empty(clip)) continue;
+
+        if (job_run) {
+            job_run(clip);
+            if (job_touched_only) {
+                tile_changed[tile] = rect_union(tile_changed[tile], tile_dirty[tile]);
+                tile_dirty[tile] = empty_rect;
+            }
+            continue;
+        }
+        for (int i = 0; i < num_binned; i++) {
+            job_draw(bin[i], clip);
+        }
+    }
+}
+
+static int tiler_worker(void* data) {
+    for (;;) {
+        SDL_SemWait(work_ready);
+        if (workers_quit) break;
+        tiler_process_tiles();
+        SDL_SemPost(work_done);
+    }
+    return 0;
+}
+
+// Wakes up the workers for the current job and helps them until all tiles are claimed and done
+static void tiler_dispatch(void) {
+    SDL_AtomicSet(&job_next_tile, 0);
+    for (int i = 0; i < tiler_thread_count - 1; i++) {
+        SDL_SemPost(work_ready);
+    }
+    tiler_process_tiles();
+    for (int i = 0; i < tiler_thread_count - 1; i++) {
+        SDL_SemWait(work_done);
+    }
+}
+
+bool tiler_init(int thread_count) {
+    tiler_thread_count = (thread_count > 0) ? thread_count : 1;
+
+    tiles_x = (window_width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (window_height + TILE_SIZE - 1) / TILE_SIZE;
+    tile_bins = (int**) calloc(tiles_x * tiles_y, sizeof(int*));
+    tile_dirty = (rect_t*) malloc(tiles_x * tiles_y * sizeof(rect_t));
+    tile_changed = (rect_t*) malloc(tiles_x * tiles_y * sizeof(rect_t));
+    if (!tile_bins || !tile_dirty || !tile_changed) {
+        fprintf(stderr, "Error allocating memory for tile bins.\n");
+        return false;
+    }
+    // Nothing is known about the contents of the render target yet
+    tiler_touch_all();
+
+    // The calling thread draws tiles too, so only thread_count - 1 workers are needed
+    if (tiler_thread_count > 1) {
+        work_ready = SDL_CreateSemaphore(0);
+        work_done = SDL_CreateSemaphore(0);
+        workers = (SDL_Thread**) calloc(tiler_thread_count - 1, sizeof(SDL_Thread*));
+        if (!work_ready || !work_done || !workers) {
+            fprintf(stderr, "Error creating the tiler worker pool.\n");
+            return false;
+        }
+        for (int i = 0; i < tiler_thread_count - 1; i++) {
+            workers[i] = SDL_CreateThread(tiler_worker, "tiler_worker", NULL);
+            if (!workers[i]) {
+                fprintf(stderr, "Error creating tiler worker thread: %s\n", SDL_GetError());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void tiler_destroy(void) {
+    if (workers) {
+        workers_quit = true;
+        for (int i = 0; i < tiler_thread_count - 1; i++) {
+            if (workers[i]) SDL_SemPost(work_ready);
+        }
+        for (int i = 0; i < tiler_thread_count - 1; i++) {
+            if (workers[i]) SDL_WaitThread(workers[i], NULL);
+        }
+        free(workers);
+        workers = NULL;
+    }
+    if (work_ready) SDL_DestroySemaphore(work_ready);
+    if (work_done) SDL_DestroySemaphore(work_done);
+    work_ready = NULL;
+    work_done = NULL;
+
+    if (tile_bins) {
+        for (int i = 0; i < tiles_x * tiles_y; i++) {
+            array_free(tile_bins[i]);
+        }
+        free(tile_bins);
+        tile_bins = NULL;
+    }
+    free(tile_dirty);
+    free(tile_changed);
+    tile_dirty = NULL;
+    tile_changed = NULL;
+}
+
+void tiler_draw(triangle_t* triangles, int num_triangles, tiler_draw_fn draw) {
+    // Binning: add every triangle to all the tiles its (padded) bounding box touches
+    for (int i = 0; i < tiles_x * tiles_y; i++) {
+        array_reset(tile_bins[i]);
+    }
+    for (int i = 0; i < num_triangles; i++) {
+        vec4_t* points = triangles[i].points;
+        int min_x = points[0].x, max_x = points[0].x;
+        int min_y = points[0].y, max_y = points[0].y;
+        for (int j = 1; j < 3; j++) {
+            int x = points[j].x;
+            int y = points[j].y;
+            if (x < min_x) min_x = x;
+            if (x > max_x) max_x = x;
+            if (y < min_y) min_y = y;
+            if (y > max_y) max_y = y;
+        }
+        min_x -= TILER_BIN_PADDING;
+        min_y -= TILER_BIN_PADDING;
+        max_x += TILER_BIN_PADDING;
+        max_y += TILER_BIN_PADDING;
+        if (min_x < 0) min_x = 0;
+        if (min_y < 0) min_y = 0;
+        if (max_x > window_width - 1) max_x = window_width - 1;
+        if (max_y > window_height - 1) max_y = window_height - 1;
+        if (min_x > max_x || min_y > max_y) continue;
+
+        // The padded box, widened to whole hierarchical z blocks, bounds the pixels the triangle draws
+        rect_t box = {
+            min_x & ~(HIZ_BLOCK_SIZE - 1),
+            min_y & ~(HIZ_BLOCK_SIZE - 1),
+            max_x | (HIZ_BLOCK_SIZE - 1),
+            max_y | (HIZ_BLOCK_SIZE - 1)
+        };
+        for (int ty = min_y / TILE_SIZE; ty <= max_y / TILE_SIZE; ty++) {
+            for (int tx = min_x / TILE_SIZE; tx <= max_x / TILE_SIZE; tx++) {
+                int tile = (tiles_x * ty) + tx;
+                array_push(tile_bins[tile], i);
+                rect_t drawn = rect_intersection(box, tile_rect(tile));
+                tile_dirty[tile] = rect_union(tile_dirty[tile], drawn);
+                tile_changed[tile] = rect_union(tile_changed[tile], drawn);
+            }
+        }
+    }
+
+    // Rasterization
+    job_draw = draw;
+    job_run = NULL;
+    job_touched_only = false;
+    tiler_dispatch();
+}
+
+void tiler_run(tiler_tile_fn run) {
+    job_draw = NULL;
+    job_run = run;
+    job_touched_only = false;
+    tiler_dispatch();
+}
+
+void tiler_touch_all(void) {
+    for (int i = 0; i < tiles_x * tiles_y; i++) {
+        rect_t tile = {(i % tiles_x) * TILE_SIZE, (i / tiles_x) * TILE_SIZE};
+        tile.max_x = tile.min_x + TILE_SIZE - 1;
+        tile.max_y = tile.min_y + TILE_SIZE - 1;
+        tile_dirty[i] = tile;
+        tile_changed[i] = tile;
+    }
+}
+
+void tiler_clear_touched(tiler_tile_fn clear) {
+    job_draw = NULL;
+    job_run = clear;
+    job_touched_only = true;
+    tiler_dispatch();
+}
+
+void tiler_take_changed(rect_t** rects) {
+    array_reset(*rects);
+    for (int ty = 0; ty < tiles_y; ty++) {
+        // One rectangle for the changes of a whole tile row, merged with the one of the row above if they
+        // have the same horizontal extent (as the rows of an object usually do)
+        rect_t row = empty_rect;
+        for (int tx = 0; tx < tiles_x; tx++) {
+            int tile = (tiles_x * ty) + tx;
+            row = rect_union(row, rect_intersection(tile_changed[tile], tile_rect(tile)));
+            tile_changed[tile] = empty_rect;
+        }
+        if (rect_empty(row)) continue;
+
+        int count = array_length(*rects);
+        rect_t* last = (count > 0) ? &(*rects)[count - 1] : NULL;
+        if (last && last->min_x == row.min_x && last->max_x == row.max_x && last->max_y + 1 == row.min_y) {
+            last->max_y = row.max_y;
+        } else {
+            array_push(*rects, row);
+        }
+    }
+}
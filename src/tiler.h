@@ -0,0 +1,49 @@
+#ifndef TILER_H
+#define TILER_H
+
+#include <stdbool.h>
+#include "display.h"
+#include "triangle.h"
+
+// Extra pixels around a triangle's bounding box when binning, covering the vertex markers
+#define TILER_BIN_PADDING 4
+
+// Draws triangle number index of the list handed to tiler_draw, writing only pixels inside clip
+typedef void (*tiler_draw_fn)(int index, rect_t clip);
+
+// Processes the screen tile covering the pixels of rect
+typedef void (*tiler_tile_fn)(rect_t tile);
+
+extern int tiler_thread_count;
+
+bool tiler_init(int thread_count);
+void tiler_destroy(void);
+
+/**
+*    Sorts the triangles into TILE_SIZE x TILE_SIZE screen tiles by bounding box, then draws the tiles
+*    in parallel on tiler_thread_count threads (the calling thread included).
+*    Tiles never overlap, so no locking is needed, and every tile draws its triangles in list order,
+*    which gives the same pixels as drawing the list serially.
+**/
+void tiler_draw(triangle_t* triangles, int num_triangles, tiler_draw_fn draw);
+
+// Runs a full-screen pass tile by tile on the same thread pool
+void tiler_run(tiler_tile_fn run);
+
+/**
+*    Lazy clears: tiler_draw records in every tile the bounding box of the triangles it draws there, and
+*    tiler_clear_touched runs clear (in parallel) on those boxes only, emptying them again. Pixels nobody
+*    drew into keep their cleared contents and are never written.
+*    tiler_touch_all marks every tile whole, for drawing that did not go through tiler_draw.
+**/
+void tiler_touch_all(void);
+void tiler_clear_touched(tiler_tile_fn clear);
+
+/**
+*    Fills the array.h array *rects (emptied first) with rectangles covering the pixels drawn into or cleared
+*    since the last call: the union of the boxes drawn this frame and the last one, which are the only
+*    pixels that can differ from the previously presented frame. No rectangles when nothing changed.
+**/
+void tiler_take_changed(rect_t** rects);
+
+#endif
@@ -1,6 +1,11 @@
 #include "triangle.h"
 #include "display.h"
 #include "swap.h"
+#include "span.h"
+#include "pipeline.h"
+#include <math.h>
+
+enum raster_method raster_method = RASTER_EDGE_FUNCTION;
 
 vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p) {
     vec2_t ab = vec2_sub(b, a);
@@ -21,10 +26,328 @@ vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p) {
     return weights;
 }
 
+/**
+*    Edge function of the directed edge a->b evaluated at point p, all in 28.4 fixed point.
+*    Positive on the inside of a clockwise (screen space) triangle, which makes it twice the signed
+*    area of the triangle abp. Dividing by the area of abc gives the barycentric weight of the vertex
+*    opposite to the edge.
+**/
+static int64_t edge_function(int64_t ax, int64_t ay, int64_t bx, int64_t by, int64_t px, int64_t py) {
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+static int64_t min3(int64_t a, int64_t b, int64_t c) {
+    int64_t m = (a < b) ? a : b;
+    return (m < c) ? m : c;
+}
+
+static int64_t max3(int64_t a, int64_t b, int64_t c) {
+    int64_t m = (a > b) ? a : b;
+    return (m > c) ? m : c;
+}
+
+/**
+*    Top-left fill rule: a pixel center exactly on an edge belongs to the triangle only if the edge is a
+*    top edge (horizontal, with the inside below it) or a left edge. Two triangles sharing an edge see it
+*    with opposite directions, so exactly one of them owns the pixels on it.
+*    Returns the bias added to the edge value before the >= 0 inside test.
+**/
+static int edge_fill_bias(int64_t ax, int64_t ay, int64_t bx, int64_t by) {
+    bool is_top = (ay == by) && (bx > ax);
+    bool is_left = (by < ay);
+    return (is_top || is_left) ? 0 : -1;
+}
+
+// Per-triangle state of the edge-function rasterizers
+typedef struct {
+    int64_t x[3];        // vertex positions in 28.4 fixed point
+    int64_t y[3];
+    int64_t e_step_x[3]; // increment of each edge function when moving one pixel right
+    int64_t e_step_y[3]; // increment of each edge function when moving one row down
+    int bias[3];         // fill rule bias of each edge
+    float inv_area;
+    rect_t bounds;       // pixels whose centers may be covered, clipped to the target rectangle
+} edge_setup_t;
+
+/**
+*    Snaps the vertices to 28.4 fixed point and sets up the edge equations, restricted to the clip rectangle.
+*    Returns false if the triangle is degenerate, leaves the guard band or does not touch the clip rectangle.
+*    *flipped is set when vertex 1 and 2 had to be swapped to make the inside positive; the caller
+*    must swap its per-vertex attributes accordingly.
+**/
+static bool edge_setup(
+    edge_setup_t* s, bool* flipped,
+    float x0, float y0, float x1, float y1, float x2, float y2,
+    rect_t clip
+) {
+    if (fabsf(x0) > RASTER_GUARD_BAND || fabsf(y0) > RASTER_GUARD_BAND ||
+        fabsf(x1) > RASTER_GUARD_BAND || fabsf(y1) > RASTER_GUARD_BAND ||
+        fabsf(x2) > RASTER_GUARD_BAND || fabsf(y2) > RASTER_GUARD_BAND) {
+        return false;
+    }
+    int64_t fx[3] = {lroundf(x0 * SUBPIXEL_ONE), lroundf(x1 * SUBPIXEL_ONE), lroundf(x2 * SUBPIXEL_ONE)};
+    int64_t fy[3] = {lroundf(y0 * SUBPIXEL_ONE), lroundf(y1 * SUBPIXEL_ONE), lroundf(y2 * SUBPIXEL_ONE)};
+
+    int64_t area = edge_function(fx[0], fy[0], fx[1], fy[1], fx[2], fy[2]);
+    if (area == 0) return false;
+    *flipped = area < 0;
+    if (*flipped) {
+        int64_t temp_x = fx[1], temp_y = fy[1];
+        fx[1] = fx[2]; fy[1] = fy[2];
+        fx[2] = temp_x; fy[2] = temp_y;
+        area = -area;
+    }
+
+    // Pixel (x, y) is sampled at its center (x + 0.5, y + 0.5)
+    const int64_t half = SUBPIXEL_ONE / 2;
+    s->bounds.min_x = (min3(fx[0], fx[1], fx[2]) - half + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+    s->bounds.min_y = (min3(fy[0], fy[1], fy[2]) - half + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+    s->bounds.max_x = (max3(fx[0], fx[1], fx[2]) - half) >> SUBPIXEL_BITS;
+    s->bounds.max_y = (max3(fy[0], fy[1], fy[2]) - half) >> SUBPIXEL_BITS;
+    if (s->bounds.min_x < clip.min_x) s->bounds.min_x = clip.min_x;
+    if (s->bounds.min_y < clip.min_y) s->bounds.min_y = clip.min_y;
+    if (s->bounds.max_x > clip.max_x) s->bounds.max_x = clip.max_x;
+    if (s->bounds.max_y > clip.max_y) s->bounds.max_y = clip.max_y;
+    if (s->bounds.min_x > s->bounds.max_x || s->bounds.min_y > s->bounds.max_y) return false;
+
+    for (int i = 0; i < 3; i++) {
+        s->x[i] = fx[i];
+        s->y[i] = fy[i];
+    }
+    // Edge i is the edge opposite to vertex i: b->c, c->a and a->b
+    for (int i = 0; i < 3; i++) {
+        int from = (i + 1) % 3;
+        int to = (i + 2) % 3;
+        s->e_step_x[i] = (fy[from] - fy[to]) * SUBPIXEL_ONE;
+        s->e_step_y[i] = (fx[to] - fx[from]) * SUBPIXEL_ONE;
+        s->bias[i] = edge_fill_bias(fx[from], fy[from], fx[to], fy[to]);
+    }
+    s->inv_area = 1.0 / area;
+    return true;
+}
+
+// Evaluates the three edge functions directly at the center of pixel (x, y)
+static void edge_evaluate(const edge_setup_t* s, int x, int y, int64_t e[3]) {
+    int64_t px = ((int64_t)x << SUBPIXEL_BITS) + SUBPIXEL_ONE / 2;
+    int64_t py = ((int64_t)y << SUBPIXEL_BITS) + SUBPIXEL_ONE / 2;
+    e[0] = edge_function(s->x[1], s->y[1], s->x[2], s->y[2], px, py);
+    e[1] = edge_function(s->x[2], s->y[2], s->x[0], s->y[0], px, py);
+    e[2] = edge_function(s->x[0], s->y[0], s->x[1], s->y[1], px, py);
+}
+
+// Value of a linearly interpolated attribute for the given (unnormalized) edge values
+static float edge_interpolate(const edge_setup_t* s, const float a[3], const int64_t e[3]) {
+    return (a[0] * (float)e[0] + a[1] * (float)e[1] + a[2] * (float)e[2]) * s->inv_area;
+}
+
+/**
+*    Converts the edge values at the top left pixel of piece into the 32 bit values stepped by the span
+*    kernels (plus their per row increments), with the fill rule bias applied. Edges that are inside over
+*    the whole piece become 0 with a 0 step, so only edges that actually cross the piece are stepped, and
+*    their values stay small.
+*    Returns false if the piece is entirely outside one of the edges.
+**/
+static bool edge_span_edges(const edge_setup_t* s, rect_t piece, const int64_t e[3], span_t* span, int e_row_step[3]) {
+    int width = piece.max_x - piece.min_x;
+    int height = piece.max_y - piece.min_y;
+    for (int i = 0; i < 3; i++) {
+        int64_t value = e[i] + s->bias[i];
+        int64_t min_value = value;
+        int64_t max_value = value;
+        if (s->e_step_x[i] < 0) min_value += s->e_step_x[i] * width; else max_value += s->e_step_x[i] * width;
+        if (s->e_step_y[i] < 0) min_value += s->e_step_y[i] * height; else max_value += s->e_step_y[i] * height;
+
+        if (max_value < 0) return false;
+        if (min_value >= 0) {
+            span->e[i] = 0;
+            span->e_step[i] = 0;
+            e_row_step[i] = 0;
+        } else {
+            span->e[i] = (int)value;
+            span->e_step[i] = (int)s->e_step_x[i];
+            e_row_step[i] = (int)s->e_step_y[i];
+        }
+    }
+    return true;
+}
+
+/**
+*    Part of the clipped bounding box that falls into the HIZ_BLOCK_SIZE block starting at (block_x, block_y).
+*    The rasterizers walk the bounding box block by block: the edge and attribute values are evaluated
+*    directly at the top left pixel of every block and only stepped incrementally inside of it. As screen
+*    tiles are made of whole blocks, a pixel gets bit-identical values no matter whether the triangle is
+*    drawn in one go or tile by tile from several threads.
+**/
+static rect_t edge_block_piece(const edge_setup_t* s, int block_x, int block_y) {
+    rect_t piece = {
+        .min_x = (block_x > s->bounds.min_x) ? block_x : s->bounds.min_x,
+        .min_y = (block_y > s->bounds.min_y) ? block_y : s->bounds.min_y,
+        .max_x = (block_x + HIZ_BLOCK_SIZE - 1 < s->bounds.max_x) ? block_x + HIZ_BLOCK_SIZE - 1 : s->bounds.max_x,
+        .max_y = (block_y + HIZ_BLOCK_SIZE - 1 < s->bounds.max_y) ? block_y + HIZ_BLOCK_SIZE - 1 : s->bounds.max_y
+    };
+    return piece;
+}
+
+/**
+*    Nearest depth (1 - 1/w) the triangle can have inside piece, given 1/w at its top left pixel and the
+*    1/w increments. 1/w is a plane, so its largest value over the piece is at one of the corners; the
+*    triangle's own nearest vertex depth bounds it as well.
+**/
+static float edge_piece_min_depth(rect_t piece, float rw, float rw_step_x, float rw_step_y, float triangle_min_depth) {
+    if (rw_step_x > 0) rw += rw_step_x * (piece.max_x - piece.min_x);
+    if (rw_step_y > 0) rw += rw_step_y * (piece.max_y - piece.min_y);
+    float min_depth = 1 - rw;
+    return (min_depth > triangle_min_depth) ? min_depth : triangle_min_depth;
+}
+
+// Nearest depth of a triangle, which is at the vertex with the largest 1/w
+static float triangle_min_depth(const float rw[3]) {
+    float max_rw = rw[0];
+    if (rw[1] > max_rw) max_rw = rw[1];
+    if (rw[2] > max_rw) max_rw = rw[2];
+    return 1 - max_rw;
+}
+
+/**
+*    Edge-function rasterizer for flat shaded triangles, writing color into target (a buffer laid out like
+*    color_buffer). The edge equations and the 1/w plane are set up once per triangle and then stepped
+*    incrementally across the bounding box: one add per row here, one add per pixel in the span kernel.
+**/
+static void draw_filled_triangle_edge(
+    float x0, float y0, float w0,
+    float x1, float y1, float w1,
+    float x2, float y2, float w2,
+    uint32_t* target, uint32_t color, rect_t clip
+) {
+    // Make the winding consistent so that the inside of the triangle has positive edge values
+    edge_setup_t s;
+    bool flipped;
+    if (!edge_setup(&s, &flipped, x0, y0, x1, y1, x2, y2, clip)) return;
+    if (flipped) float_swap(&w1, &w2);
+
+    // 1/w is linear in screen space, so it can be stepped the same way as the edge functions
+    float rw[3] = {1 / w0, 1 / w1, 1 / w2};
+    float rw_step_x = edge_interpolate(&s, rw, s.e_step_x);
+    float rw_step_y = edge_interpolate(&s, rw, s.e_step_y);
+
+    // Skip the whole triangle if the hierarchical z-buffer shows it is hidden everywhere
+    bool depth_test = pipeline.state.depth_test;
+    float min_depth = triangle_min_depth(rw);
+    if (depth_test && hiz_rejects(s.bounds, min_depth)) return;
+
+    for (int block_y = (s.bounds.min_y / HIZ_BLOCK_SIZE) * HIZ_BLOCK_SIZE; block_y <= s.bounds.max_y; block_y += HIZ_BLOCK_SIZE) {
+        for (int block_x = (s.bounds.min_x / HIZ_BLOCK_SIZE) * HIZ_BLOCK_SIZE; block_x <= s.bounds.max_x; block_x += HIZ_BLOCK_SIZE) {
+            rect_t piece = edge_block_piece(&s, block_x, block_y);
+            int64_t e[3];
+            edge_evaluate(&s, piece.min_x, piece.min_y, e);
+            span_t span;
+            int e_row_step[3];
+            if (!edge_span_edges(&s, piece, e, &span, e_row_step)) continue;
+            span.rw = edge_interpolate(&s, rw, e);
+            span.rw_step = rw_step_x;
+
+            // Skip the block if the triangle cannot get nearer than what is already stored in it
+            float* hiz = &hiz_buffer[(hiz_width * (block_y / HIZ_BLOCK_SIZE)) + (block_x / HIZ_BLOCK_SIZE)];
+            if (depth_test && edge_piece_min_depth(piece, span.rw, rw_step_x, rw_step_y, min_depth) >= *hiz) continue;
+
+            bool written = false;
+            for (int y = piece.min_y; y <= piece.max_y; y++) {
+                written |= pipeline.filled_span(&target[block_row_index(block_x, y)], depth_address(block_row_index(block_x, y)), piece.min_x, piece.max_x, &span, color);
+
+                span.e[0] += e_row_step[0];
+                span.e[1] += e_row_step[1];
+                span.e[2] += e_row_step[2];
+                span.rw += rw_step_y;
+            }
+            if (written && pipeline.state.depth_write) hiz_update_block(block_x / HIZ_BLOCK_SIZE, block_y / HIZ_BLOCK_SIZE);
+        }
+    }
+}
+
+/**
+*    Edge-function rasterizer for perspective correct textured triangles.
+*    Same stepping as draw_filled_triangle_edge, with u/w, v/w and 1/w interpolated as screen space planes.
+**/
+static void draw_textured_triangle_edge(
+    float x0, float y0, float w0, float u0, float v0,
+    float x1, float y1, float w1, float u1, float v1,
+    float x2, float y2, float w2, float u2, float v2,
+    uint32_t* texture, rect_t clip
+) {
+    edge_setup_t s;
+    bool flipped;
+    if (!edge_setup(&s, &flipped, x0, y0, x1, y1, x2, y2, clip)) return;
+    if (flipped) {
+        float_swap(&w1, &w2);
+        float_swap(&u1, &u2);
+        float_swap(&v1, &v2);
+    }
+
+    // Flip the v component to account for inverted UV-coordinated (V grows downwards)
+    v0 = 1 - v0;
+    v1 = 1 - v1;
+    v2 = 1 - v2;
+
+    // Per-vertex values of 1/w, u/w and v/w, which are all linear in screen space
+    float rw[3] = {1 / w0, 1 / w1, 1 / w2};
+    float uw[3] = {u0 * rw[0], u1 * rw[1], u2 * rw[2]};
+    float vw[3] = {v0 * rw[0], v1 * rw[1], v2 * rw[2]};
+
+    float rw_step_x = edge_interpolate(&s, rw, s.e_step_x);
+    float rw_step_y = edge_interpolate(&s, rw, s.e_step_y);
+    float uw_step_x = edge_interpolate(&s, uw, s.e_step_x);
+    float uw_step_y = edge_interpolate(&s, uw, s.e_step_y);
+    float vw_step_x = edge_interpolate(&s, vw, s.e_step_x);
+    float vw_step_y = edge_interpolate(&s, vw, s.e_step_y);
+
+    // Skip the whole triangle if the hierarchical z-buffer shows it is hidden everywhere
+    bool depth_test = pipeline.state.depth_test;
+    float min_depth = triangle_min_depth(rw);
+    if (depth_test && hiz_rejects(s.bounds, min_depth)) return;
+
+    for (int block_y = (s.bounds.min_y / HIZ_BLOCK_SIZE) * HIZ_BLOCK_SIZE; block_y <= s.bounds.max_y; block_y += HIZ_BLOCK_SIZE) {
+        for (int block_x = (s.bounds.min_x / HIZ_BLOCK_SIZE) * HIZ_BLOCK_SIZE; block_x <= s.bounds.max_x; block_x += HIZ_BLOCK_SIZE) {
+            rect_t piece = edge_block_piece(&s, block_x, block_y);
+            int64_t e[3];
+            edge_evaluate(&s, piece.min_x, piece.min_y, e);
+            span_t span;
+            int e_row_step[3];
+            if (!edge_span_edges(&s, piece, e, &span, e_row_step)) continue;
+            span.rw = edge_interpolate(&s, rw, e);
+            span.rw_step = rw_step_x;
+
+            // Skip the block if the triangle cannot get nearer than what is already stored in it
+            float* hiz = &hiz_buffer[(hiz_width * (block_y / HIZ_BLOCK_SIZE)) + (block_x / HIZ_BLOCK_SIZE)];
+            if (depth_test && edge_piece_min_depth(piece, span.rw, rw_step_x, rw_step_y, min_depth) >= *hiz) continue;
+            span.uw = edge_interpolate(&s, uw, e);
+            span.vw = edge_interpolate(&s, vw, e);
+            span.uw_step = uw_step_x;
+            span.vw_step = vw_step_x;
+
+            bool written = false;
+            for (int y = piece.min_y; y <= piece.max_y; y++) {
+                written |= pipeline.textured_span(&color_buffer[block_row_index(block_x, y)], depth_address(block_row_index(block_x, y)), piece.min_x, piece.max_x, &span, texture);
+
+                span.e[0] += e_row_step[0];
+                span.e[1] += e_row_step[1];
+                span.e[2] += e_row_step[2];
+                span.rw += rw_step_y;
+                span.uw += uw_step_y;
+                span.vw += vw_step_y;
+            }
+            if (written && pipeline.state.depth_write) hiz_update_block(block_x / HIZ_BLOCK_SIZE, block_y / HIZ_BLOCK_SIZE);
+        }
+    }
+}
+
 void draw_unfilled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color) {
-    draw_line(x0, y0, x1, y1, color);
-    draw_line(x1, y1, x2, y2, color);
-    draw_line(x2, y2, x0, y0, color);
+    draw_unfilled_triangle_clipped(x0, y0, x1, y1, x2, y2, color, screen_rect());
+}
+
+void draw_unfilled_triangle_clipped(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color, rect_t clip) {
+    draw_line_clipped(x0, y0, x1, y1, color, clip);
+    draw_line_clipped(x1, y1, x2, y2, color, clip);
+    draw_line_clipped(x2, y2, x0, y0, color, clip);
 }
 
 void draw_filled_triangle(
@@ -33,6 +356,11 @@ void draw_filled_triangle(
     int x2, int y2, float w2,
     uint32_t color
 ) {
+    if (raster_method == RASTER_EDGE_FUNCTION) {
+        draw_filled_triangle_edge(x0, y0, w0, x1, y1, w1, x2, y2, w2, color_buffer, color, screen_rect());
+        return;
+    }
+
     // Sort the vertices and their corresponding uv values by y-coordinate ascending (y0, y1, y2)
     if (y0 > y1) {
         int_swap(&y0, &y1);
@@ -64,10 +392,13 @@ void draw_filled_triangle(
         inv_slope_2 = (float) (x2 - x0) / abs(y2 - y0);
 
     if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
+        for (int y = (y0 > 0) ? y0 : 0; y <= y1 && y < window_height; y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
             if (x_end < x_start) int_swap(&x_start, &x_end);
+            // Spans are cut to the frame here, so the pixels need no bounds checks
+            if (x_start < 0) x_start = 0;
+            if (x_end > window_width) x_end = window_width;
             for (int x = x_start; x < x_end; x++) {
                 vec2_t point_p = {x, y};
                 // Get the barycentric weights for the current point
@@ -76,11 +407,11 @@ void draw_filled_triangle(
                 float interpolated_reciprocal_w = (1 / w0) * weights.x + (1 / w1) * weights.y + (1 / w2) * weights.z;
                 interpolated_reciprocal_w = 1 - interpolated_reciprocal_w;
                 // Determine if this pixel is closer to the screen, and if so, render it and update the z-buffer
-                if (interpolated_reciprocal_w < z_buffer[(window_width * y) + x]) {
+                if (depth_compare(depth_format, z_buffer, pixel_index(x, y), interpolated_reciprocal_w) < 0) {
                     // Draw a pixel at position (x, y) with the color that comes from the mapped texture
-                    draw_pixel(x, y, color);
+                    color_buffer[pixel_index(x, y)] = color;
                     // Update the z-buffer value with the 1/w of this current pixel
-                    z_buffer[(window_width * y) + x] = interpolated_reciprocal_w;
+                    depth_store(depth_format, z_buffer, pixel_index(x, y), interpolated_reciprocal_w);
                 }
             }
         }
@@ -96,10 +427,12 @@ void draw_filled_triangle(
         inv_slope_2 = (float) (x2 - x0) / abs(y2 - y0);
 
     if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
+        for (int y = (y1 > 0) ? y1 : 0; y <= y2 && y < window_height; y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
             if (x_end < x_start) int_swap(&x_start, &x_end);
+            if (x_start < 0) x_start = 0;
+            if (x_end > window_width) x_end = window_width;
             for (int x = x_start; x < x_end; x++) {
                 vec2_t point_p = {x, y};
                 // Get the barycentric weights for the current point
@@ -108,17 +441,27 @@ void draw_filled_triangle(
                 float interpolated_reciprocal_w = (1 / w0) * weights.x + (1 / w1) * weights.y + (1 / w2) * weights.z;
                 interpolated_reciprocal_w = 1 - interpolated_reciprocal_w;
                 // Determine if this pixel is closer to the screen, and if so, render it and update the z-buffer
-                if (interpolated_reciprocal_w < z_buffer[(window_width * y) + x]) {
+                if (depth_compare(depth_format, z_buffer, pixel_index(x, y), interpolated_reciprocal_w) < 0) {
                     // Draw a pixel at position (x, y) with the color that comes from the mapped texture
-                    draw_pixel(x, y, color);
+                    color_buffer[pixel_index(x, y)] = color;
                     // Update the z-buffer value with the 1/w of this current pixel
-                    z_buffer[(window_width * y) + x] = interpolated_reciprocal_w;
+                    depth_store(depth_format, z_buffer, pixel_index(x, y), interpolated_reciprocal_w);
                 }
             }
         }
     }
 }
 
+void draw_filled_triangle_clipped(const triangle_t* triangle, rect_t clip) {
+    const vec4_t* p = triangle->points;
+    draw_filled_triangle_edge(p[0].x, p[0].y, p[0].w, p[1].x, p[1].y, p[1].w, p[2].x, p[2].y, p[2].w, color_buffer, triangle->color, clip);
+}
+
+void draw_visibility_triangle_clipped(const triangle_t* triangle, uint32_t triangle_index, rect_t clip) {
+    const vec4_t* p = triangle->points;
+    draw_filled_triangle_edge(p[0].x, p[0].y, p[0].w, p[1].x, p[1].y, p[1].w, p[2].x, p[2].y, p[2].w, visibility_buffer, triangle_index, clip);
+}
+
 // Function to draw the textured pixel at position x and y using interpolation
 void draw_texel(
     int x, int y, uint32_t* texture,
@@ -161,12 +504,12 @@ void draw_texel(
     interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
 
     // Only draw the pixel if the depth value is less than the one previously stored in the z-buffer
-    if (interpolated_reciprocal_w < z_buffer[(window_width * y) + x]) {
+    if (depth_compare(depth_format, z_buffer, pixel_index(x, y), interpolated_reciprocal_w) < 0) {
         // Draw a pixel at position (x, y) with the color that comes from the mapped texture
-        draw_pixel(x, y, texture[(texture_width * tex_y) + tex_x]);
+        color_buffer[pixel_index(x, y)] = texture[(texture_width * tex_y) + tex_x];
 
         // Update the z-buffer value with the 1/w of this current pixel
-        z_buffer[(window_width * y) + x] = interpolated_reciprocal_w;
+        depth_store(depth_format, z_buffer, pixel_index(x, y), interpolated_reciprocal_w);
     }
 }
 
@@ -176,6 +519,11 @@ void draw_textured_triangle(
     int x2, int y2, float z2, float w2, float u2, float v2,
     uint32_t* texture
 ) {
+    if (raster_method == RASTER_EDGE_FUNCTION) {
+        draw_textured_triangle_edge(x0, y0, w0, u0, v0, x1, y1, w1, u1, v1, x2, y2, w2, u2, v2, texture, screen_rect());
+        return;
+    }
+
     // Sort the vertices and their corresponding uv values by y-coordinate ascending (y0, y1, y2)
     if (y0 > y1) {
         int_swap(&y0, &y1);
@@ -226,10 +574,13 @@ void draw_textured_triangle(
         inv_slope_2 = (float) (x2 - x0) / abs(y2 - y0);
 
     if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
+        for (int y = (y0 > 0) ? y0 : 0; y <= y1 && y < window_height; y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
             if (x_end < x_start) int_swap(&x_start, &x_end);
+            // Cut the span to the frame, which spares draw_texel any bounds checks
+            if (x_start < 0) x_start = 0;
+            if (x_end > window_width) x_end = window_width;
             for (int x = x_start; x < x_end; x++) {
                 // Draw out pixel with the color that comes from the texture
                 draw_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
@@ -248,14 +599,27 @@ void draw_textured_triangle(
         inv_slope_2 = (float) (x2 - x0) / abs(y2 - y0);
 
     if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
+        for (int y = (y1 > 0) ? y1 : 0; y <= y2 && y < window_height; y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
             if (x_end < x_start) int_swap(&x_start, &x_end);
+            if (x_start < 0) x_start = 0;
+            if (x_end > window_width) x_end = window_width;
             for (int x = x_start; x < x_end; x++) {
                 // Draw out pixel with the color that comes from the texture
                 draw_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
             }
         }
     }
+}
+
+void draw_textured_triangle_clipped(const triangle_t* triangle, uint32_t* texture, rect_t clip) {
+    const vec4_t* p = triangle->points;
+    const tex2_t* uv = triangle->texcoords;
+    draw_textured_triangle_edge(
+        p[0].x, p[0].y, p[0].w, uv[0].u, uv[0].v,
+        p[1].x, p[1].y, p[1].w, uv[1].u, uv[1].v,
+        p[2].x, p[2].y, p[2].w, uv[2].u, uv[2].v,
+        texture, clip
+    );
 }
\ No newline at end of file
@@ -2,8 +2,10 @@
 #define TRIANGLE_H
 
 #include <stdint.h>
+#include <math.h>
 #include "vector.h"
 #include "texture.h"
+#include "display.h"
 
 // stuct for housing indices of mesh array that correspond to a face
 typedef struct {
@@ -14,16 +16,42 @@ typedef struct {
     tex2_t b_uv;
     tex2_t c_uv;
     uint32_t color;
+    vec3_t normal;        // unit normal in model space, computed when the mesh is loaded
+    float plane_distance; // dot product of normal with the points of the face
 }  face_t;
 
 typedef struct {
     vec4_t points[3];
     tex2_t texcoords[3];
     uint32_t color;
-    int avg_depth;
+    float avg_depth;
 } triangle_t;
 
+/*
+*    Vertices must lie within this many pixels of the origin. This keeps the edge values of blocks that
+*    an edge crosses inside 32 bits, so the span kernels can step them with plain integer adds.
+*    The clip stage (clip.h) keeps triangles inside it; the rasterizers skip any that still reach farther out.
+*/
+#define RASTER_GUARD_BAND 32768
+
+// Fractional bits of the fixed-point (28.4) vertex positions used by the edge-function rasterizers
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+
+// A screen coordinate snapped to 28.4 fixed point, rounded the way the edge-function rasterizers round it
+static inline float raster_snap(float coordinate) {
+    return roundf(coordinate * SUBPIXEL_ONE) / SUBPIXEL_ONE;
+}
+
+// Rasterizer core used by draw_filled_triangle and draw_textured_triangle
+enum raster_method {
+    RASTER_SCANLINE,     // flat-bottom/flat-top split with per-pixel barycentric weights
+    RASTER_EDGE_FUNCTION // incremental edge functions over the bounding box
+};
+extern enum raster_method raster_method;
+
 void draw_unfilled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
+void draw_unfilled_triangle_clipped(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color, rect_t clip);
 
 void draw_filled_triangle(
     int x0, int y0, float w0,
@@ -32,6 +60,21 @@ void draw_filled_triangle(
     uint32_t color
 );
 
+/**
+*    Draws only the part of the triangle inside clip with triangle->color; always uses the edge function
+*    rasterizer, with the depth state and span kernel of the bound pipeline (see pipeline.h).
+*    Vertex positions keep their sub-pixel precision (snapped to 28.4 fixed point) and pixels on shared
+*    edges are owned by exactly one triangle (top-left rule).
+**/
+void draw_filled_triangle_clipped(const triangle_t* triangle, rect_t clip);
+
+/**
+*    Visibility pass of the deferred texturing mode: depth tests the triangle like draw_filled_triangle_clipped,
+*    but stores triangle_index into visibility_buffer instead of a color.
+**/
+void draw_visibility_triangle_clipped(const triangle_t* triangle, uint32_t triangle_index, rect_t clip);
+
+// Draws pixel (x, y) of a textured triangle; (x, y) must lie inside the frame
 void draw_texel(
     int x, int y, uint32_t* texture,
     vec4_t point_a, vec4_t point_b, vec4_t point_c,
@@ -45,4 +88,7 @@ void draw_textured_triangle(
     uint32_t* texture
 );
 
-#endif
\ No newline at end of file
+// Textured counterpart of draw_filled_triangle_clipped
+void draw_textured_triangle_clipped(const triangle_t* triangle, uint32_t* texture, rect_t clip);
+
+#endif
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "vertex.h"
+#include "clip.h"
+
+#define VERTEX_ALIGNMENT 32
+
+bool vertex_stream_resize(vertex_stream_t* stream, int count, int num_coordinates) {
+    int capacity = (count + VERTEX_BATCH - 1) / VERTEX_BATCH * VERTEX_BATCH;
+    bool has_w = (num_coordinates == 4);
+    if (stream->storage && capacity <= stream->capacity && has_w == (stream->w != NULL)) {
+        stream->count = count;
+        return true;
+    }
+    vertex_stream_free(stream);
+
+    // One block for every coordinate, aligned by hand; each array is a whole number of batches long, so all stay aligned
+    size_t array_size = sizeof(float) * capacity;
+    stream->storage = calloc(1, array_size * num_coordinates + VERTEX_ALIGNMENT);
+    if (!stream->storage) {
+        fprintf(stderr, "Error allocating memory for %d vertices.\n", count);
+        return false;
+    }
+    uintptr_t address = ((uintptr_t)stream->storage + VERTEX_ALIGNMENT - 1) & ~(uintptr_t)(VERTEX_ALIGNMENT - 1);
+    stream->x = (float*)address;
+    stream->y = stream->x + capacity;
+    stream->z = stream->y + capacity;
+    stream->w = has_w ? stream->z + capacity : NULL;
+    stream->count = count;
+    stream->capacity = capacity;
+    return true;
+}
+
+void vertex_stream_free(vertex_stream_t* stream) {
+    free(stream->storage);
+    *stream = (vertex_stream_t){0};
+}
+
+bool vertex_stream_from_vec3(vertex_stream_t* stream, const vec3_t* positions, int count, int num_coordinates) {
+    if (!vertex_stream_resize(stream, count, num_coordinates)) return false;
+    for (int i = 0; i < stream->capacity; i++) {
+        bool padding = (i >= count);
+        stream->x[i] = padding ? 0 : positions[i].x;
+        stream->y[i] = padding ? 0 : positions[i].y;
+        stream->z[i] = padding ? 0 : positions[i].z;
+        if (stream->w) stream->w[i] = padding ? 0 : 1;
+    }
+    return true;
+}
+
+/**
+*    The products are summed in the order mat4_mul_vec4 sums them, and the input w of 1 is left out of the
+*    last one, which keeps every path bit-identical to the one vertex at a time functions of matrix.c.
+**/
+static void transform_vertex(const vertex_stream_t* positions, const mat4_t* m, const mat4_t* p, float half_width,
+    float half_height, float guard_x, float guard_y, vertex_stream_t* world, vertex_stream_t* screen, uint16_t* clip_codes, int i) {
+    float x = positions->x[i];
+    float y = positions->y[i];
+    float z = positions->z[i];
+    float wx = m->m[0][0] * x + m->m[0][1] * y + m->m[0][2] * z + m->m[0][3];
+    float wy = m->m[1][0] * x + m->m[1][1] * y + m->m[1][2] * z + m->m[1][3];
+    float wz = m->m[2][0] * x + m->m[2][1] * y + m->m[2][2] * z + m->m[2][3];
+    float ww = m->m[3][0] * x + m->m[3][1] * y + m->m[3][2] * z + m->m[3][3];
+    float cx = p->m[0][0] * wx + p->m[0][1] * wy + p->m[0][2] * wz + p->m[0][3] * ww;
+    float cy = p->m[1][0] * wx + p->m[1][1] * wy + p->m[1][2] * wz + p->m[1][3] * ww;
+    float cz = p->m[2][0] * wx + p->m[2][1] * wy + p->m[2][2] * wz + p->m[2][3] * ww;
+    float cw = p->m[3][0] * wx + p->m[3][1] * wy + p->m[3][2] * wz + p->m[3][3] * ww;
+    clip_codes[i] = clip_point_codes((vec4_t){cx, cy, cz, cw}, guard_x, guard_y);
+
+    // Perspective divide, skipped for points on the plane of the camera
+    if (cw != 0) {
+        cx /= cw;
+        cy /= cw;
+        cz /= cw;
+    }
+    world->x[i] = wx;
+    world->y[i] = wy;
+    world->z[i] = wz;
+    screen->x[i] = cx * half_width + half_width;
+    screen->y[i] = half_height - cy * half_height;
+    screen->z[i] = cz;
+    screen->w[i] = cw;
+}
+
+#if defined(__AVX2__)
+// Row r of matrix m times the vector (x, y, z, w) of 8 vertices
+static inline __m256 row_dot_8(const __m256 m[4][4], int r, __m256 x, __m256 y, __m256 z, __m256 w) {
+    return _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[r][0], x), _mm256_mul_ps(m[r][1], y)),
+        _mm256_mul_ps(m[r][2], z)), _mm256_mul_ps(m[r][3], w));
+}
+
+static inline __m256 row_dot_point_8(const __m256 m[4][4], int r, __m256 x, __m256 y, __m256 z) {
+    return _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[r][0], x), _mm256_mul_ps(m[r][1], y)),
+        _mm256_mul_ps(m[r][2], z)), m[r][3]);
+}
+
+// Clip codes of 8 clip space positions, as 8 integers
+static inline __m256i clip_codes_8(__m256 x, __m256 y, __m256 z, __m256 w, __m256 guard_x, __m256 guard_y) {
+    __m256 gx = _mm256_mul_ps(guard_x, w);
+    __m256 gy = _mm256_mul_ps(guard_y, w);
+    __m256 outside[10] = {
+        _mm256_cmp_ps(z, _mm256_setzero_ps(), _CMP_LT_OQ), _mm256_cmp_ps(z, w, _CMP_GT_OQ),
+        _mm256_cmp_ps(x, _mm256_sub_ps(_mm256_setzero_ps(), gx), _CMP_LT_OQ), _mm256_cmp_ps(x, gx, _CMP_GT_OQ),
+        _mm256_cmp_ps(y, gy, _CMP_GT_OQ), _mm256_cmp_ps(y, _mm256_sub_ps(_mm256_setzero_ps(), gy), _CMP_LT_OQ),
+        _mm256_cmp_ps(x, _mm256_sub_ps(_mm256_setzero_ps(), w), _CMP_LT_OQ), _mm256_cmp_ps(x, w, _CMP_GT_OQ),
+        _mm256_cmp_ps(y, w, _CMP_GT_OQ), _mm256_cmp_ps(y, _mm256_sub_ps(_mm256_setzero_ps(), w), _CMP_LT_OQ)
+    };
+    __m256 codes = _mm256_setzero_ps();
+    for (int plane = 0; plane < 10; plane++) {
+        codes = _mm256_or_ps(codes, _mm256_and_ps(outside[plane], _mm256_castsi256_ps(_mm256_set1_epi32(1 << plane))));
+    }
+    return _mm256_castps_si256(codes);
+}
+
+static void transform_batches(const vertex_stream_t* positions, const mat4_t* world_matrix, const mat4_t* proj_matrix,
+    float half_width, float half_height, float guard_x, float guard_y, vertex_stream_t* world, vertex_stream_t* screen,
+    uint16_t* clip_codes, int end) {
+    __m256 m[4][4], p[4][4];
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            m[r][c] = _mm256_set1_ps(world_matrix->m[r][c]);
+            p[r][c] = _mm256_set1_ps(proj_matrix->m[r][c]);
+        }
+    }
+    __m256 hw = _mm256_set1_ps(half_width);
+    __m256 hh = _mm256_set1_ps(half_height);
+    __m256 gx = _mm256_set1_ps(guard_x);
+    __m256 gy = _mm256_set1_ps(guard_y);
+    for (int i = 0; i < end; i += 8) {
+        __m256 x = _mm256_load_ps(&positions->x[i]);
+        __m256 y = _mm256_load_ps(&positions->y[i]);
+        __m256 z = _mm256_load_ps(&positions->z[i]);
+        __m256 wx = row_dot_point_8(m, 0, x, y, z);
+        __m256 wy = row_dot_point_8(m, 1, x, y, z);
+        __m256 wz = row_dot_point_8(m, 2, x, y, z);
+        __m256 ww = row_dot_point_8(m, 3, x, y, z);
+        __m256 cx = row_dot_8(p, 0, wx, wy, wz, ww);
+        __m256 cy = row_dot_8(p, 1, wx, wy, wz, ww);
+        __m256 cz = row_dot_8(p, 2, wx, wy, wz, ww);
+        __m256 cw = row_dot_8(p, 3, wx, wy, wz, ww);
+        __m256i codes = clip_codes_8(cx, cy, cz, cw, gx, gy);
+        _mm_storeu_si128((__m128i*)&clip_codes[i], _mm_packs_epi32(_mm256_castsi256_si128(codes), _mm256_extractf128_si256(codes, 1)));
+        __m256 divide = _mm256_cmp_ps(cw, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+        cx = _mm256_blendv_ps(cx, _mm256_div_ps(cx, cw), divide);
+        cy = _mm256_blendv_ps(cy, _mm256_div_ps(cy, cw), divide);
+        cz = _mm256_blendv_ps(cz, _mm256_div_ps(cz, cw), divide);
+        _mm256_store_ps(&world->x[i], wx);
+        _mm256_store_ps(&world->y[i], wy);
+        _mm256_store_ps(&world->z[i], wz);
+        _mm256_store_ps(&screen->x[i], _mm256_add_ps(_mm256_mul_ps(cx, hw), hw));
+        _mm256_store_ps(&screen->y[i], _mm256_sub_ps(hh, _mm256_mul_ps(cy, hh)));
+        _mm256_store_ps(&screen->z[i], cz);
+        _mm256_store_ps(&screen->w[i], cw);
+    }
+}
+#define TRANSFORM_BATCH 8
+#elif defined(__SSE2__)
+// Row r of matrix m times the vector (x, y, z, w) of 4 vertices
+static inline __m128 row_dot_4(const __m128 m[4][4], int r, __m128 x, __m128 y, __m128 z, __m128 w) {
+    return _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r][0], x), _mm_mul_ps(m[r][1], y)),
+        _mm_mul_ps(m[r][2], z)), _mm_mul_ps(m[r][3], w));
+}
+
+static inline __m128 row_dot_point_4(const __m128 m[4][4], int r, __m128 x, __m128 y, __m128 z) {
+    return _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r][0], x), _mm_mul_ps(m[r][1], y)),
+        _mm_mul_ps(m[r][2], z)), m[r][3]);
+}
+
+// a where mask is set, b elsewhere
+static inline __m128 select_4(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Clip codes of 4 clip space positions, as 4 integers
+static inline __m128i clip_codes_4(__m128 x, __m128 y, __m128 z, __m128 w, __m128 guard_x, __m128 guard_y) {
+    __m128 gx = _mm_mul_ps(guard_x, w);
+    __m128 gy = _mm_mul_ps(guard_y, w);
+    __m128 outside[10] = {
+        _mm_cmplt_ps(z, _mm_setzero_ps()), _mm_cmpgt_ps(z, w),
+        _mm_cmplt_ps(x, _mm_sub_ps(_mm_setzero_ps(), gx)), _mm_cmpgt_ps(x, gx),
+        _mm_cmpgt_ps(y, gy), _mm_cmplt_ps(y, _mm_sub_ps(_mm_setzero_ps(), gy)),
+        _mm_cmplt_ps(x, _mm_sub_ps(_mm_setzero_ps(), w)), _mm_cmpgt_ps(x, w),
+        _mm_cmpgt_ps(y, w), _mm_cmplt_ps(y, _mm_sub_ps(_mm_setzero_ps(), w))
+    };
+    __m128i codes = _mm_setzero_si128();
+    for (int plane = 0; plane < 10; plane++) {
+        codes = _mm_or_si128(codes, _mm_and_si128(_mm_castps_si128(outside[plane]), _mm_set1_epi32(1 << plane)));
+    }
+    return codes;
+}
+
+static void transform_batches(const vertex_stream_t* positions, const mat4_t* world_matrix, const mat4_t* proj_matrix,
+    float half_width, float half_height, float guard_x, float guard_y, vertex_stream_t* world, vertex_stream_t* screen,
+    uint16_t* clip_codes, int end) {
+    __m128 m[4][4], p[4][4];
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            m[r][c] = _mm_set1_ps(world_matrix->m[r][c]);
+            p[r][c] = _mm_set1_ps(proj_matrix->m[r][c]);
+        }
+    }
+    __m128 hw = _mm_set1_ps(half_width);
+    __m128 hh = _mm_set1_ps(half_height);
+    __m128 gx = _mm_set1_ps(guard_x);
+    __m128 gy = _mm_set1_ps(guard_y);
+    for (int i = 0; i < end; i += 4) {
+        __m128 x = _mm_load_ps(&positions->x[i]);
+        __m128 y = _mm_load_ps(&positions->y[i]);
+        __m128 z = _mm_load_ps(&positions->z[i]);
+        __m128 wx = row_dot_point_4(m, 0, x, y, z);
+        __m128 wy = row_dot_point_4(m, 1, x, y, z);
+        __m128 wz = row_dot_point_4(m, 2, x, y, z);
+        __m128 ww = row_dot_point_4(m, 3, x, y, z);
+        __m128 cx = row_dot_4(p, 0, wx, wy, wz, ww);
+        __m128 cy = row_dot_4(p, 1, wx, wy, wz, ww);
+        __m128 cz = row_dot_4(p, 2, wx, wy, wz, ww);
+        __m128 cw = row_dot_4(p, 3, wx, wy, wz, ww);
+        __m128i codes = clip_codes_4(cx, cy, cz, cw, gx, gy);
+        _mm_storel_epi64((__m128i*)&clip_codes[i], _mm_packs_epi32(codes, codes));
+        __m128 divide = _mm_cmpneq_ps(cw, _mm_setzero_ps());
+        cx = select_4(divide, _mm_div_ps(cx, cw), cx);
+        cy = select_4(divide, _mm_div_ps(cy, cw), cy);
+        cz = select_4(divide, _mm_div_ps(cz, cw), cz);
+        _mm_store_ps(&world->x[i], wx);
+        _mm_store_ps(&world->y[i], wy);
+        _mm_store_ps(&world->z[i], wz);
+        _mm_store_ps(&screen->x[i], _mm_add_ps(_mm_mul_ps(cx, hw), hw));
+        _mm_store_ps(&screen->y[i], _mm_sub_ps(hh, _mm_mul_ps(cy, hh)));
+        _mm_store_ps(&screen->z[i], cz);
+        _mm_store_ps(&screen->w[i], cw);
+    }
+}
+#define TRANSFORM_BATCH 4
+#endif
+
+bool vertex_transform(const vertex_stream_t* positions, mat4_t world_matrix, mat4_t proj_matrix, int width, int height,
+    vertex_stream_t* world, vertex_stream_t* screen, uint16_t* clip_codes) {
+    if (!vertex_stream_resize(world, positions->count, 3) || !vertex_stream_resize(screen, positions->count, 4)) {
+        return false;
+    }
+    float half_width = width / 2.0f;
+    float half_height = height / 2.0f;
+    float guard_x = clip_guard_band(width);
+    float guard_y = clip_guard_band(height);
+    int start = 0;
+#if defined(TRANSFORM_BATCH)
+    // The padding of the streams lets the last batch run past count
+    start = (positions->count + TRANSFORM_BATCH - 1) / TRANSFORM_BATCH * TRANSFORM_BATCH;
+    transform_batches(positions, &world_matrix, &proj_matrix, half_width, half_height, guard_x, guard_y, world, screen, clip_codes, start);
+#endif
+    for (int i = start; i < positions->count; i++) {
+        transform_vertex(positions, &world_matrix, &proj_matrix, half_width, half_height, guard_x, guard_y, world, screen, clip_codes, i);
+    }
+    return true;
+}
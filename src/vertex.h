@@ -0,0 +1,50 @@
+#ifndef VERTEX_H
+#define VERTEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "vector.h"
+#include "matrix.h"
+
+// Vertices transformed per step of vertex_transform; streams are padded to a multiple of it
+#define VERTEX_BATCH 8
+
+/**
+*    Vertices stored as a structure of arrays: one array per coordinate, each 32 byte aligned and padded
+*    with zeros up to a multiple of VERTEX_BATCH, so the transform loads and stores whole SIMD registers of
+*    consecutive vertices with no tail. w is NULL in streams of 3 coordinates.
+**/
+typedef struct {
+    float* x;
+    float* y;
+    float* z;
+    float* w;
+    int count;    // vertices in the stream, padding excluded
+    int capacity; // vertices allocated in each array, padding included
+    void* storage;
+} vertex_stream_t;
+
+// Sets the vertex count of stream, reallocating only when it grows; the contents are lost on reallocation
+bool vertex_stream_resize(vertex_stream_t* stream, int count, int num_coordinates);
+void vertex_stream_free(vertex_stream_t* stream);
+
+// Fills stream with count positions, and w = 1 when it has 4 coordinates
+bool vertex_stream_from_vec3(vertex_stream_t* stream, const vec3_t* positions, int count, int num_coordinates);
+
+static inline vec4_t vertex_stream_get(const vertex_stream_t* stream, int index) {
+    vec4_t v = {stream->x[index], stream->y[index], stream->z[index], stream->w ? stream->w[index] : 1.0f};
+    return v;
+}
+
+/**
+*    Transforms the positions of a mesh by world_matrix into world (x, y, z), then projects them by
+*    proj_matrix and maps them to a viewport of width x height pixels into screen (x, y, z after the divide
+*    by w, and w), with y pointing down. The clip codes (see clip.h) of the projected positions go into
+*    clip_codes, which needs room for positions->capacity of them.
+*    Each step handles VERTEX_BATCH vertices with AVX, 4 at a time with SSE, one at a time otherwise; all
+*    of them give the same results. world and screen are resized to fit.
+**/
+bool vertex_transform(const vertex_stream_t* positions, mat4_t world_matrix, mat4_t proj_matrix, int width, int height,
+    vertex_stream_t* world, vertex_stream_t* screen, uint16_t* clip_codes);
+
+#endif
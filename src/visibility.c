@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include "array.h"
+#include "visibility.h"
+
+// Screen space plane of a linearly interpolated value: value(x, y) = origin + x * step_x + y * step_y
+typedef struct {
+    float origin;
+    float step_x;
+    float step_y;
+} plane_t;
+
+// Perspective correct interpolation planes of a textured triangle
+typedef struct {
+    plane_t rw; // 1/w
+    plane_t uw; // u/w
+    plane_t vw; // v/w
+} triangle_planes_t;
+
+static triangle_planes_t* planes = NULL; // dynamic array, one entry per triangle to render
+static uint32_t* shade_texture = NULL;
+static int shade_wrap = TEXEL_REPEAT; // TEXEL_ mode of shade_texture
+
+static plane_t plane_from_vertices(const vec4_t points[3], float inv_area, float a0, float a1, float a2) {
+    float dx1 = points[1].x - points[0].x, dy1 = points[1].y - points[0].y;
+    float dx2 = points[2].x - points[0].x, dy2 = points[2].y - points[0].y;
+    plane_t plane;
+    plane.step_x = ((a1 - a0) * dy2 - (a2 - a0) * dy1) * inv_area;
+    plane.step_y = ((a2 - a0) * dx1 - (a1 - a0) * dx2) * inv_area;
+    plane.origin = a0 - plane.step_x * points[0].x - plane.step_y * points[0].y;
+    return plane;
+}
+
+void visibility_prepare(triangle_t* triangles, int num_triangles, uint32_t* texture, enum texture_wrap wrap) {
+    array_reset(planes);
+    if (num_triangles > 0) {
+        planes = array_hold(planes, num_triangles, sizeof(triangle_planes_t));
+    }
+    shade_texture = texture;
+    shade_wrap = span_texel_wrap(wrap);
+
+    for (int i = 0; i < num_triangles; i++) {
+        const vec4_t* points = triangles[i].points;
+        const tex2_t* uv = triangles[i].texcoords;
+
+        // The planes go through the snapped vertices, which decide the pixels the triangle covers
+        vec4_t p[3];
+        for (int j = 0; j < 3; j++) {
+            p[j] = points[j];
+            p[j].x = raster_snap(points[j].x);
+            p[j].y = raster_snap(points[j].y);
+        }
+
+        // Flip the v component to account for inverted UV-coordinated (V grows downwards)
+        float rw[3] = {1 / p[0].w, 1 / p[1].w, 1 / p[2].w};
+        float uw[3] = {uv[0].u * rw[0], uv[1].u * rw[1], uv[2].u * rw[2]};
+        float vw[3] = {(1 - uv[0].v) * rw[0], (1 - uv[1].v) * rw[1], (1 - uv[2].v) * rw[2]};
+        // Exact in double for 28.4 coordinates within the guard band, so zero exactly when the rasterizer skips it
+        double area = (double)(p[1].x - p[0].x) * (p[2].y - p[0].y) - (double)(p[2].x - p[0].x) * (p[1].y - p[0].y);
+        if (area == 0) {
+            // Never rasterized, but its entry is still set rather than left over from an earlier frame
+            planes[i].rw = (plane_t){(rw[0] + rw[1] + rw[2]) / 3, 0, 0};
+            planes[i].uw = (plane_t){(uw[0] + uw[1] + uw[2]) / 3, 0, 0};
+            planes[i].vw = (plane_t){(vw[0] + vw[1] + vw[2]) / 3, 0, 0};
+            continue;
+        }
+        float inv_area = (float)(1 / area);
+        planes[i].rw = plane_from_vertices(p, inv_area, rw[0], rw[1], rw[2]);
+        planes[i].uw = plane_from_vertices(p, inv_area, uw[0], uw[1], uw[2]);
+        planes[i].vw = plane_from_vertices(p, inv_area, vw[0], vw[1], vw[2]);
+    }
+}
+
+// Called with a constant wrap from visibility_shade_tile, which leaves one texel addressing per instance
+static inline void shade_tile(rect_t tile, int wrap) {
+    for (int y = tile.min_y; y <= tile.max_y; y++) {
+        float center_y = y + 0.5;
+
+        for (int x = tile.min_x; x <= tile.max_x; x++) {
+            int pixel = pixel_index(x, y);
+            uint32_t index = visibility_buffer[pixel];
+            if (index == VISIBILITY_NONE) continue;
+            visibility_buffer[pixel] = VISIBILITY_NONE;
+
+            // Evaluate the planes at the pixel center, where the visibility pass sampled coverage and depth
+            const triangle_planes_t* t = &planes[index];
+            float center_x = x + 0.5;
+            float interpolated_reciprocal_w = t->rw.origin + t->rw.step_x * center_x + t->rw.step_y * center_y;
+            float interpolated_u = t->uw.origin + t->uw.step_x * center_x + t->uw.step_y * center_y;
+            float interpolated_v = t->vw.origin + t->vw.step_x * center_x + t->vw.step_y * center_y;
+
+            float w = 1 / interpolated_reciprocal_w;
+            int tex_x = texel_wrap((int)(interpolated_u * w * texture_width), texture_width, wrap);
+            int tex_y = texel_wrap((int)(interpolated_v * w * texture_height), texture_height, wrap);
+            color_buffer[pixel] = shade_texture[(texture_width * tex_y) + tex_x];
+        }
+    }
+}
+
+void visibility_shade_tile(rect_t tile) {
+    switch (shade_wrap) {
+        case TEXEL_REPEAT_POW2: shade_tile(tile, TEXEL_REPEAT_POW2); break;
+        case TEXEL_CLAMP: shade_tile(tile, TEXEL_CLAMP); break;
+        default: shade_tile(tile, TEXEL_REPEAT); break;
+    }
+}
+
+void visibility_free(void) {
+    array_free(planes);
+    planes = NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include <stdint.h>
+#include "display.h"
+#include "triangle.h"
+#include "span.h"
+
+/**
+*    Deferred texturing: a first pass rasterizes only depth and triangle indices into visibility_buffer
+*    (draw_visibility_triangle_clipped), then a full-screen pass shades every visible pixel exactly once.
+**/
+
+// Sets up the interpolation planes of the triangles whose indices were written by the visibility pass, and
+// the texture they are shaded with, wrapped like the forward textured spans do
+void visibility_prepare(triangle_t* triangles, int num_triangles, uint32_t* texture, enum texture_wrap wrap);
+
+// Shades the visible pixels inside tile into color_buffer and resets them in visibility_buffer (tiler_run callback)
+void visibility_shade_tile(rect_t tile);
+
+void visibility_free(void);
+
+#endif